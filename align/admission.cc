@@ -0,0 +1,67 @@
+#include "admission.h"
+#include "audio_decode.h"
+#include "rates.h"
+#include <algorithm>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+// Per 10msec frame: 13 MFCCs + 39 features (floats), plus whatever the search's backpointer table and lattice grow
+// to - the latter being the bulk of it, and the vaguest.
+const size_t BYTES_PER_FRAME = 1024;
+
+size_t estimate_job_memory(const SegmentationJob &job) {
+  unsigned int audio_msec = job_audio_msec(job);
+  return MSEC2WAVF(audio_msec) * sizeof(int16_t) + MSEC2MFCCF(audio_msec) * BYTES_PER_FRAME;
+}
+
+size_t estimate_decoded_audio_memory(const SegmentationJob &job) {
+  // 16kHz 16-bit mono is 256kbps - 8x the lowest bitrate EveryAyah publishes MP3s at.
+  const size_t DECODED_BYTES_PER_MP3_BYTE = 8;
+  struct stat st;
+  if (!is_compressed_audio(job.in_file) || stat(job.in_file.c_str(), &st) != 0) {
+    return 0;
+  }
+  return st.st_size * DECODED_BYTES_PER_MP3_BYTE;
+}
+
+size_t peak_rss() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return (size_t)usage.ru_maxrss * 1024;
+}
+
+void AdmissionController::AdmitJob(size_t bytes) {
+  std::unique_lock<std::mutex> lock(_mtx);
+  _cv.wait(lock, [&] { return !_budget || !_job_ct || _resident + _job_bytes + bytes <= _budget; });
+  _job_bytes += bytes;
+  _job_ct++;
+  _peak = std::max(_peak, _resident + _job_bytes);
+}
+
+void AdmissionController::FinishJob(size_t bytes) {
+  {
+    std::lock_guard<std::mutex> lock(_mtx);
+    _job_bytes -= bytes;
+    _job_ct--;
+  }
+  _cv.notify_all();
+}
+
+void AdmissionController::AddResident(size_t bytes) {
+  std::lock_guard<std::mutex> lock(_mtx);
+  _resident += bytes;
+  _peak = std::max(_peak, _resident + _job_bytes);
+}
+
+void AdmissionController::RemoveResident(size_t bytes) {
+  {
+    std::lock_guard<std::mutex> lock(_mtx);
+    _resident -= bytes;
+  }
+  _cv.notify_all();
+}
+
+size_t AdmissionController::PeakEstimate() {
+  std::lock_guard<std::mutex> lock(_mtx);
+  return _peak;
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include "segment.h"
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+
+// Rough resident memory a job needs on top of its worker's decoder: the mapped audio, plus the MFCC, feature and
+// search buffers that all scale with its length.
+size_t estimate_job_memory(const SegmentationJob &job);
+
+// Rough size of a job's audio once decoded, if it's compressed and needs decoding at all - otherwise 0.
+size_t estimate_decoded_audio_memory(const SegmentationJob &job);
+
+// Peak RSS of this process so far, bytes.
+size_t peak_rss();
+
+// Holds jobs back until their estimated memory fits within the budget alongside everything already resident.
+// Decoders are counted but never held back - they live as long as their worker, so waiting on them would just deadlock
+// - so size the worker count to fit them instead. A job too big for the budget on its own still runs, just alone.
+class AdmissionController {
+public:
+  // A zero budget admits everything, but still tracks the estimate.
+  AdmissionController(size_t budget_bytes) : _budget(budget_bytes) {}
+  void AdmitJob(size_t bytes);
+  void FinishJob(size_t bytes);
+  void AddResident(size_t bytes);
+  void RemoveResident(size_t bytes);
+  size_t PeakEstimate();
+
+private:
+  size_t _budget;
+  size_t _resident = 0, _job_bytes = 0, _job_ct = 0, _peak = 0;
+  std::mutex _mtx;
+  std::condition_variable _cv;
+};
@@ -0,0 +1,97 @@
+#include "affinity.h"
+#include <algorithm>
+#include <cstdio>
+#include <dirent.h>
+#include <fstream>
+#include <pthread.h>
+#include <sched.h>
+#include <sstream>
+#include <thread>
+
+std::vector<unsigned int> parse_cpu_list(const std::string &list) {
+  std::vector<unsigned int> cpus;
+  std::istringstream ranges(list);
+  std::string range;
+  while (std::getline(ranges, range, ',')) {
+    unsigned int first, last;
+    char dash;
+    std::istringstream bounds(range);
+    if (!(bounds >> first)) {
+      continue;
+    }
+    last = bounds >> dash >> last && dash == '-' ? last : first;
+    for (unsigned int cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+std::vector<std::vector<unsigned int>> numa_node_cpus() {
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    for (unsigned int cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); ++cpu) {
+      CPU_SET(cpu, &allowed);
+    }
+  }
+
+  std::vector<std::vector<unsigned int>> nodes;
+  DIR *dir_handle = opendir("/sys/devices/system/node");
+  if (dir_handle) {
+    std::vector<unsigned int> node_numbers;
+    struct dirent *entry;
+    while ((entry = readdir(dir_handle))) {
+      unsigned int node;
+      if (sscanf(entry->d_name, "node%u", &node) == 1) {
+        node_numbers.push_back(node);
+      }
+    }
+    closedir(dir_handle);
+    std::sort(node_numbers.begin(), node_numbers.end());
+    for (auto node = node_numbers.begin(); node != node_numbers.end(); node++) {
+      std::ifstream cpulist_file("/sys/devices/system/node/node" + std::to_string(*node) + "/cpulist");
+      std::string cpulist;
+      std::getline(cpulist_file, cpulist);
+      std::vector<unsigned int> cpus;
+      auto node_cpus = parse_cpu_list(cpulist);
+      for (auto cpu = node_cpus.begin(); cpu != node_cpus.end(); cpu++) {
+        if (*cpu < CPU_SETSIZE && CPU_ISSET(*cpu, &allowed)) {
+          cpus.push_back(*cpu);
+        }
+      }
+      // Memory-only nodes, or ones we've been fenced off from.
+      if (!cpus.empty()) {
+        nodes.push_back(cpus);
+      }
+    }
+  }
+
+  if (nodes.empty()) {
+    nodes.emplace_back();
+    for (unsigned int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &allowed)) {
+        nodes.back().push_back(cpu);
+      }
+    }
+  }
+  return nodes;
+}
+
+std::vector<WorkerPlacement> place_workers(const std::vector<std::vector<unsigned int>> &node_cpus,
+                                           unsigned int worker_ct) {
+  std::vector<WorkerPlacement> placements;
+  std::vector<size_t> next_cpu(node_cpus.size());
+  for (unsigned int worker = 0; worker < worker_ct; ++worker) {
+    unsigned int node = worker % node_cpus.size();
+    placements.push_back({node_cpus[node][next_cpu[node]++ % node_cpus[node].size()], node});
+  }
+  return placements;
+}
+
+bool pin_current_thread(unsigned int cpu) {
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  return pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include <string>
+#include <vector>
+
+// Parses a kernel CPU list, e.g. "0-3,8-11".
+std::vector<unsigned int> parse_cpu_list(const std::string &list);
+
+// The CPUs we're allowed to run on, grouped by NUMA node as per /sys/devices/system/node. Without NUMA (or sysfs)
+// that's just the one node.
+std::vector<std::vector<unsigned int>> numa_node_cpus();
+
+struct WorkerPlacement {
+  unsigned int cpu;
+  unsigned int node; // Index into numa_node_cpus(), not necessarily the kernel's node number.
+};
+
+// A CPU for each worker, dealing workers out across nodes in turn so they're evenly split. CPUs are only reused once
+// there are more workers than CPUs.
+std::vector<WorkerPlacement> place_workers(const std::vector<std::vector<unsigned int>> &node_cpus,
+                                           unsigned int worker_ct);
+
+// Pins the calling thread to cpu. Returns false if the kernel won't have it.
+bool pin_current_thread(unsigned int cpu);
@@ -0,0 +1,134 @@
+#include "audio_decode.h"
+#include "debug.h"
+#include "rates.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdexcept>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+bool is_compressed_audio(const std::string &path) {
+  return path.size() >= 4 && path.compare(path.size() - 4, 4, ".mp3") == 0;
+}
+
+std::vector<int16_t> decode_compressed_audio(const std::string &path) {
+  int pipe_fds[2];
+  // Close-on-exec, or ffmpegs spawned by other decoder threads would inherit our write end and hold EOF off until
+  // they exit too.
+  if (pipe2(pipe_fds, O_CLOEXEC) != 0) {
+    throw std::runtime_error("Couldn't create pipe for " + path);
+  }
+  posix_spawn_file_actions_t file_actions;
+  posix_spawn_file_actions_init(&file_actions);
+  posix_spawn_file_actions_adddup2(&file_actions, pipe_fds[1], STDOUT_FILENO);
+  posix_spawn_file_actions_addclose(&file_actions, pipe_fds[0]);
+  posix_spawn_file_actions_addclose(&file_actions, pipe_fds[1]);
+  posix_spawn_file_actions_addopen(&file_actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+  const std::string sample_rate = std::to_string(WAV_SAMPLE_RATE);
+  const char *argv[] = {"ffmpeg", "-nostdin", "-v", "error", "-i", path.c_str(), "-f", "s16le", "-ac", "1", "-ar",
+                        sample_rate.c_str(), "-", NULL};
+  pid_t pid;
+  int spawn_err = posix_spawnp(&pid, "ffmpeg", &file_actions, NULL, (char *const *)argv, environ);
+  posix_spawn_file_actions_destroy(&file_actions);
+  close(pipe_fds[1]);
+  if (spawn_err) {
+    close(pipe_fds[0]);
+    throw std::runtime_error(std::string("Couldn't run ffmpeg: ") + strerror(spawn_err));
+  }
+
+  std::vector<char> bytes;
+  char buf[1 << 16];
+  ssize_t n;
+  while ((n = read(pipe_fds[0], buf, sizeof(buf))) > 0 || (n < 0 && errno == EINTR)) {
+    if (n > 0) {
+      bytes.insert(bytes.end(), buf, buf + n);
+    }
+  }
+  close(pipe_fds[0]);
+  int status = 0;
+  pid_t waited;
+  while ((waited = waitpid(pid, &status, 0)) < 0 && errno == EINTR) {
+  }
+  if (waited < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    throw std::runtime_error("ffmpeg couldn't decode " + path);
+  }
+
+  std::vector<int16_t> samples(bytes.size() / sizeof(int16_t));
+  memcpy(samples.data(), bytes.data(), samples.size() * sizeof(int16_t));
+  return samples;
+}
+
+AudioDecodeStage::AudioDecodeStage(const std::vector<std::string> &paths, size_t depth, unsigned int thread_ct)
+    : _paths(paths), _depth(depth ? depth : 1) {
+  for (unsigned int i = 0; i < thread_ct; ++i) {
+    _threads.emplace_back([this] { run(); });
+  }
+}
+
+AudioDecodeStage::~AudioDecodeStage() {
+  {
+    std::lock_guard<std::mutex> lock(_mtx);
+    _stop = true;
+  }
+  _cv.notify_all();
+  for (auto thread = _threads.begin(); thread != _threads.end(); thread++) {
+    thread->join();
+  }
+}
+
+std::vector<int16_t> AudioDecodeStage::Take(size_t index) {
+  std::unique_lock<std::mutex> lock(_mtx);
+  _cv.wait(lock, [&] { return _ready.count(index) || _errors.count(index); });
+  _outstanding--;
+  _cv.notify_all();
+  auto error = _errors.find(index);
+  if (error != _errors.end()) {
+    std::string message = error->second;
+    _errors.erase(error);
+    throw std::runtime_error(message);
+  }
+  auto samples = std::move(_ready[index]);
+  _ready.erase(index);
+  return samples;
+}
+
+void AudioDecodeStage::run() {
+  while (true) {
+    size_t index;
+    {
+      std::unique_lock<std::mutex> lock(_mtx);
+      _cv.wait(lock, [&] { return _stop || _next >= _paths.size() || _outstanding < _depth; });
+      while (_next < _paths.size() && !is_compressed_audio(_paths[_next])) {
+        _next++;
+      }
+      if (_stop || _next >= _paths.size()) {
+        return;
+      }
+      index = _next++;
+      _outstanding++;
+    }
+
+    DEBUG("Decode " << _paths[index]);
+    std::vector<int16_t> samples;
+    std::string error;
+    try {
+      samples = decode_compressed_audio(_paths[index]);
+    } catch (const std::exception &e) {
+      error = e.what();
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(_mtx);
+      if (error.empty()) {
+        _ready[index] = std::move(samples);
+      } else {
+        _errors[index] = error;
+      }
+    }
+    _cv.notify_all();
+  }
+}
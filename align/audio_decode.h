@@ -0,0 +1,37 @@
+#pragma once
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Whether a file needs decoding (i.e. it's an MP3) rather than being mapped straight in as a WAV.
+bool is_compressed_audio(const std::string &path);
+
+// Decodes (and resamples) an MP3 to the 16kHz mono samples we work with. This is done by piping it through ffmpeg -
+// the same tool our WAVs came out of - so the decoded audio never touches the disk.
+std::vector<int16_t> decode_compressed_audio(const std::string &path);
+
+// Decodes the compressed files among paths on thread_ct threads, in order, keeping up to depth of them decoded ahead of
+// the workers.
+class AudioDecodeStage {
+public:
+  AudioDecodeStage(const std::vector<std::string> &paths, size_t depth, unsigned int thread_ct);
+  ~AudioDecodeStage();
+  // Blocks until paths[index] is decoded, then hands over its samples. Throws if it couldn't be decoded.
+  std::vector<int16_t> Take(size_t index);
+
+private:
+  void run();
+  const std::vector<std::string> &_paths;
+  size_t _depth;
+  size_t _next = 0;        // Next index to claim for decoding.
+  size_t _outstanding = 0; // Claimed but not yet taken.
+  bool _stop = false;
+  std::map<size_t, std::vector<int16_t>> _ready;
+  std::map<size_t, std::string> _errors;
+  std::mutex _mtx;
+  std::condition_variable _cv;
+  std::vector<std::thread> _threads;
+};
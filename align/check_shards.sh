@@ -0,0 +1,32 @@
+#!/bin/sh
+# Checks that splitting a run with --shard and recombining it with --merge gives exactly what one unsharded run does.
+# Usage: ./check_shards.sh N [align options] quran.txt quran.liaise.txt ps.cfg audio files...
+# Runs use --budget=0, so no ayah falls back to an even split just because the machine was busy at the time.
+set -e
+
+if [ $# -lt 5 ]; then
+  echo "$0 N [align options] quran.txt quran.liaise.txt ps.cfg ..._sssaaa.wav [..._sssaaa.wav etc.]" >&2
+  exit 1
+fi
+ALIGN=${ALIGN:-./align}
+shard_ct=$1
+shift
+
+work_dir=$(mktemp -d)
+trap 'rm -rf "$work_dir"' EXIT
+
+"$ALIGN" --budget=0 "$@" > "$work_dir/whole.json"
+for shard_by in hash size; do
+  shard=0
+  while [ $shard -lt "$shard_ct" ]; do
+    "$ALIGN" --budget=0 --shard=$shard/$shard_ct --shard-by=$shard_by "$@" > "$work_dir/shard_$shard.json"
+    shard=$((shard + 1))
+  done
+  "$ALIGN" --merge "$work_dir"/shard_*.json > "$work_dir/merged.json"
+  if ! cmp -s "$work_dir/whole.json" "$work_dir/merged.json"; then
+    echo "--shard-by=$shard_by: $shard_ct merged shards differ from the unsharded run" >&2
+    exit 1
+  fi
+  echo "--shard-by=$shard_by: $shard_ct merged shards match the unsharded run"
+  rm -f "$work_dir"/shard_*.json
+done
@@ -0,0 +1,81 @@
+#include "corpus.h"
+#include "audio_decode.h"
+#include "debug.h"
+#include <cctype>
+#include <fstream>
+#include <sstream>
+
+// http://stackoverflow.com/a/236803
+static void split(const std::string &s, char delim, std::vector<std::string> &elems) {
+  std::stringstream ss;
+  ss.str(s);
+  std::string item;
+  while (std::getline(ss, item, delim)) {
+    elems.push_back(item);
+  }
+}
+
+Corpus::Corpus(const std::string &quran_path, const std::string &liaise_path) {
+  // Load Quran text file.
+  // (Tanzil.net format)
+  std::ifstream quran_file(quran_path);
+  std::string value;
+  while (quran_file.good()) {
+    std::getline(quran_file, value, '|');
+    if (!value.length()) {
+      continue;
+    }
+    if (value[0] == '#') {
+      std::getline(quran_file, value);
+      continue;
+    }
+    int surah_ayah_key = stoi(value) * 1000;
+    std::getline(quran_file, value, '|');
+    surah_ayah_key += stoi(value);
+    std::getline(quran_file, value, '\n');
+    _text[surah_ayah_key] = value;
+  }
+  quran_file.close();
+
+  // Load liaise-point definitions.
+  std::ifstream quran_liaise_file(liaise_path);
+  while (quran_liaise_file.good()) {
+    uint16_t surah_num, ayah_num, word, flags;
+    quran_liaise_file >> surah_num;
+    quran_liaise_file >> ayah_num;
+    quran_liaise_file >> word;
+    quran_liaise_file >> flags;
+    _liaise_points[surah_num * 1000 + ayah_num].push_back({word, (LiaiseFlags)flags});
+  }
+}
+
+bool Corpus::HasAyah(unsigned short surah, unsigned short ayah) const { return _text.count(surah * 1000 + ayah); }
+
+SegmentationJob Corpus::MakeJob(unsigned short surah, unsigned short ayah, const std::string &in_file) const {
+  std::vector<std::string> words;
+  auto text = _text.find(surah * 1000 + ayah);
+  if (text != _text.end()) {
+    DEBUG("Prep " << text->second);
+    split(text->second, ' ', words);
+  }
+  std::vector<LiaisePoint> liaise_points;
+  auto points = _liaise_points.find(surah * 1000 + ayah);
+  if (points != _liaise_points.end()) {
+    liaise_points = points->second;
+  }
+  return {surah, ayah, in_file, words, liaise_points};
+}
+
+bool parse_audio_filename(const std::string &path, unsigned short &surah, unsigned short &ayah) {
+  if (path.size() < 10 || (path.compare(path.size() - 4, 4, ".wav") != 0 && !is_compressed_audio(path))) {
+    return false;
+  }
+  for (size_t i = path.size() - 10; i < path.size() - 4; ++i) {
+    if (!isdigit(path[i])) {
+      return false;
+    }
+  }
+  surah = stoi(path.substr(path.size() - 10, 3));
+  ayah = stoi(path.substr(path.size() - 7, 3));
+  return true;
+}
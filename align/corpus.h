@@ -0,0 +1,21 @@
+#pragma once
+#include "segment.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// The reference text and liaise points for the whole Qur'an, keyed by surah * 1000 + ayah.
+class Corpus {
+public:
+  Corpus(const std::string &quran_path, const std::string &liaise_path);
+  SegmentationJob MakeJob(unsigned short surah, unsigned short ayah, const std::string &in_file) const;
+  bool HasAyah(unsigned short surah, unsigned short ayah) const;
+
+private:
+  std::unordered_map<unsigned int, std::string> _text;
+  std::unordered_map<unsigned int, std::vector<LiaisePoint>> _liaise_points;
+};
+
+// Pulls the surah & ayah numbers out of an EveryAyah-style ..._sssaaa.wav (or .mp3) filename. Returns false if it
+// isn't one.
+bool parse_audio_filename(const std::string &path, unsigned short &surah, unsigned short &ayah);
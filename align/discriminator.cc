@@ -10,111 +10,109 @@
 
 // How many elements are in each MFCC vector.
 const size_t VECTOR_STRIDE = 13;
-// Controls the window size for power calculations.
-const size_t POWER_WINDOW = MSEC2WAVF(50);
-const size_t POWER_WINDOW_STEP = POWER_WINDOW;
-const float POWER_SILENCE_START = -100; // A silence starts at this power, dbFS...
-const float POWER_SILENCE_END = -75;    // ...and ends at this, also dbFS.
 
-std::vector<std::pair<uint32_t, uint32_t>> discriminate_silence_periods(const int16_t *audio, uint32_t length_msec) {
+// RMS power of the window samples before window_end, dbFS.
+static float window_power(const int16_t *window_end, size_t window) {
+  float sum = 0;
+  for (int x = -(int)window; x < 0; ++x) {
+    float val = (float)window_end[x] / 32768;
+    sum += val * val;
+  }
+  return 20 * std::log10(sum / (window / 2));
+}
+
+bool SilenceDetector::Push(const int16_t *window_end, uint32_t window_end_msec,
+                           std::pair<uint32_t, uint32_t> &silence) {
   // No explicit debouncing, but our hysteresis range is fairly large.
-  uint32_t silence_start;
-  bool in_silence = false;
+  float power = window_power(window_end, _params.power_window);
+  if (!_in_silence && power < _params.power_silence_start) {
+    _in_silence = true;
+    _silence_start = window_end_msec;
+  } else if (_in_silence && power > _params.power_silence_end) {
+    _in_silence = false;
+    silence = std::make_pair(_silence_start, window_end_msec);
+    return true;
+  }
+  return false;
+}
+
+std::vector<std::pair<uint32_t, uint32_t>> discriminate_silence_periods(const int16_t *audio, uint32_t length_msec,
+                                                                        const DiscriminatorParams &params) {
+  SilenceDetector detector(params);
+  std::pair<uint32_t, uint32_t> silence;
   std::vector<std::pair<uint32_t, uint32_t>> results;
-  for (unsigned int frame = POWER_WINDOW; frame < MSEC2WAVF(length_msec); frame += POWER_WINDOW_STEP) {
-    // RMS power.
-    float sum = 0;
-    for (int x = -(int)POWER_WINDOW; x < 0; ++x) {
-      float val = (float)audio[frame + x] / 32768;
-      sum += val * val;
-    }
-    float power = 20 * std::log10(sum / (POWER_WINDOW / 2));
-    if (!in_silence && power < POWER_SILENCE_START) {
-      in_silence = true;
-      silence_start = WAVF2MSEC(frame);
-    } else if (in_silence && power > POWER_SILENCE_END) {
-      in_silence = false;
-      results.emplace_back(silence_start, WAVF2MSEC(frame));
+  for (unsigned int frame = params.power_window; frame < MSEC2WAVF(length_msec); frame += params.power_window) {
+    if (detector.Push(audio + frame, WAVF2MSEC(frame), silence)) {
+      results.push_back(silence);
     }
   }
   return results;
 }
 
-static std::vector<size_t> discriminate_transitions_power(const int16_t *audio, size_t len) {
+bool PowerTransitionDetector::Push(const int16_t *window_end) {
   const float POWER_VEL_CAP = 10;
-  // We use an online stdev approximation to find peaks within the audio.
-  // Decay factors for mean and variance values:
-  const float A_MEAN = 0.99;
-  const float A_VAR = 0.97;
-  // Cap for sample count used in online variance calculation, to account for the exponential running average configured
-  // above.
+  // We use an online stdev approximation to find peaks within the audio, with the decay factors and threshold (in
+  // stdevs) from _params.
+  // Cap for sample count used in online variance calculation, to account for the exponential running average.
   const int VAR_MIX_CAP = 100;
-  // Empirically determined multiplier - power velocity higher than this factor times the current stdev triggers the
-  // detector.
-  const float THRESH_SIGMA = 1.6;
-  // Skip this many frames at the start - one of those things I don't think is actually needed but am scared to remove.
-  const int SKIP_LEAD = 30;
 
-  float last_power = 0;
-  float mean_power_vel = 0;
-  float m2_power_vel = 0;
-  int n_samples = 0;
-  bool in_peak = false;
-  std::vector<size_t> transitions;
-  for (unsigned int i = POWER_WINDOW + MSEC2WAVF(SKIP_LEAD); i < len; i += POWER_WINDOW_STEP) {
-    // RMS power.
-    float sum = 0;
-    for (int x = -(int)POWER_WINDOW; x < 0; ++x) {
-      float val = (float)audio[i + x] / 32768;
-      sum += val * val;
-    }
-    if (sum == 0) {
-      continue;
-    }
-    n_samples++;
-    float power = 20 * std::log10(sum / (POWER_WINDOW / 2));
-    if (power < POWER_SILENCE_END) {
-      // Drop silent frames - they can't get up to any good.
-      continue;
-    }
-    if (last_power == 0) {
-      last_power = power;
+  float power = window_power(window_end, _params.power_window);
+  if (std::isinf(power)) {
+    // Digital silence.
+    return false;
+  }
+  _n_samples++;
+  if (power < _params.power_silence_end) {
+    // Drop silent frames - they can't get up to any good.
+    return false;
+  }
+  if (_last_power == 0) {
+    _last_power = power;
+  }
+  float vel = std::min(POWER_VEL_CAP, std::abs(power - _last_power));
+  _last_power = power;
+  float delta = vel - _mean_power_vel;
+  _mean_power_vel = (_mean_power_vel + delta / _n_samples) * _params.power_a_mean + (1 - _params.power_a_mean) * vel;
+  _m2_power_vel = (_m2_power_vel + delta * (vel - _mean_power_vel)) * _params.power_a_var;
+  bool transition = false;
+  if (_n_samples > 1) {
+    float variance = std::sqrt(_m2_power_vel / std::min(VAR_MIX_CAP, (_n_samples - 1))) * _params.power_thresh_sigma;
+    if (vel > _mean_power_vel + variance) {
+      transition = !_in_peak;
+      _in_peak = true;
+    } else {
+      _in_peak = false;
     }
-    float vel = std::min(POWER_VEL_CAP, std::abs(power - last_power));
-    last_power = power;
-    float delta = vel - mean_power_vel;
-    mean_power_vel = (mean_power_vel + delta / n_samples) * A_MEAN + (1 - A_MEAN) * vel;
-    m2_power_vel = (m2_power_vel + delta * (vel - mean_power_vel)) * A_VAR;
-    if (n_samples > 1) {
-      float variance = std::sqrt(m2_power_vel / std::min(VAR_MIX_CAP, (n_samples - 1))) * THRESH_SIGMA;
-      if (vel > mean_power_vel + variance) {
-        if (!in_peak) {
-          transitions.push_back(i - POWER_WINDOW);
-        }
-        in_peak = true;
-      } else {
-        in_peak = false;
-      }
+  }
+  return transition;
+}
+
+static std::vector<size_t> discriminate_transitions_power(const int16_t *audio, size_t len,
+                                                          const DiscriminatorParams &params) {
+  PowerTransitionDetector detector(params);
+  std::vector<size_t> transitions;
+  for (unsigned int i = params.power_window + MSEC2WAVF(POWER_TRANSITION_SKIP_LEAD); i < len;
+       i += params.power_window) {
+    if (detector.Push(audio + i)) {
+      transitions.push_back(i - params.power_window);
     }
   }
   return transitions;
 }
 
-static std::vector<size_t> discriminate_transitions_mfcc(mfcc_t **mfcc, size_t len) {
+static std::vector<size_t> discriminate_transitions_mfcc(const mfcc_t *const *mfcc, size_t len,
+                                                         const DiscriminatorParams &params) {
   // As above.
-  const float A_MEAN = 0.95;
-  const float A_VAR = 0.999;
   const float A_VAR_IN_PEAK = 1;
   const int VAR_MIX_CAP = 100;
-  const float THRESH_SIGMA = 2.3;
 
   float mean_vel = 0;
   float m2_vel = 0;
   std::vector<size_t> transitions;
   DUMP_STREAM("MFCC GO");
   for (size_t i = 3; i < len; ++i) {
-    float *last_frame = mfcc[(i - 1)];
-    float *this_frame = mfcc[i];
+    const float *last_frame = mfcc[(i - 1)];
+    const float *this_frame = mfcc[i];
     float vel = 0;
     for (size_t x = 0; x < VECTOR_STRIDE; ++x) {
       vel += std::pow((last_frame[x] - this_frame[x]), 2);
@@ -123,7 +121,7 @@ static std::vector<size_t> discriminate_transitions_mfcc(mfcc_t **mfcc, size_t l
     float delta = vel - mean_vel;
     bool in_peak = false;
     if (i > 0) {
-      float stdev_thresh = std::sqrt(m2_vel / i) * THRESH_SIGMA;
+      float stdev_thresh = std::sqrt(m2_vel / i) * params.mfcc_thresh_sigma;
       DUMP_STREAM(MFCCF2MSEC(i) << "\t" << vel << "\t" << mean_vel << "\t" << mean_vel + stdev_thresh << "\t"
                                 << mean_vel - stdev_thresh);
       if (vel > stdev_thresh + mean_vel) {
@@ -131,16 +129,28 @@ static std::vector<size_t> discriminate_transitions_mfcc(mfcc_t **mfcc, size_t l
         in_peak = true;
       }
     }
-    mean_vel = (mean_vel + delta / std::min((size_t)VAR_MIX_CAP, (i + 1))) * A_MEAN + (1 - A_MEAN) * vel;
-    m2_vel = (m2_vel + delta * (vel - mean_vel) * (in_peak ? A_VAR_IN_PEAK : 1)) * A_VAR;
+    mean_vel = (mean_vel + delta / std::min((size_t)VAR_MIX_CAP, (i + 1))) * params.mfcc_a_mean +
+               (1 - params.mfcc_a_mean) * vel;
+    m2_vel = (m2_vel + delta * (vel - mean_vel) * (in_peak ? A_VAR_IN_PEAK : 1)) * params.mfcc_a_var;
   }
   DUMP_STREAM("MFCC END");
   return transitions;
 }
 
-std::vector<uint32_t> discriminate_transitions(const int16_t *audio, mfcc_t **mfcc, uint32_t length_msec) {
-  auto result_mfcc = discriminate_transitions_mfcc(mfcc, MSEC2MFCCF(length_msec) - 1);
-  auto result_power = discriminate_transitions_power(audio, MSEC2WAVF(length_msec) - 1);
+std::vector<uint32_t> discriminate_transitions(const int16_t *audio, const mfcc_t *const *mfcc, size_t mfcc_frames,
+                                               uint32_t length_msec, const DiscriminatorParams &params) {
+  // Neither looks at the last frame. There may also be fewer MFCC frames than the audio would suggest.
+  size_t mfcc_len = MSEC2MFCCF(length_msec) ? std::min<size_t>(MSEC2MFCCF(length_msec) - 1, mfcc_frames) : 0;
+  size_t audio_len = length_msec ? MSEC2WAVF(length_msec) - 1 : 0;
+  auto result_power = discriminate_transitions_power(audio, audio_len, params);
+  if (!mfcc_len) {
+    std::vector<uint32_t> transitions_msec;
+    for (auto power_tn_iter = result_power.begin(); power_tn_iter != result_power.end(); power_tn_iter++) {
+      transitions_msec.push_back(WAVF2MSEC(*power_tn_iter));
+    }
+    return transitions_msec;
+  }
+  auto result_mfcc = discriminate_transitions_mfcc(mfcc, mfcc_len, params);
 
   // Interleave the two result sequences chronologically.
   // We treat them equivalently after this point.
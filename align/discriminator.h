@@ -1,10 +1,59 @@
 #pragma once
 #include "pocketsphinx.h"
+#include "rates.h"
 #include <cstdint>
 #include <vector>
 
+// Tunables for the discriminators - the defaults are what they were tuned to by hand. See params.h for loading them.
+struct DiscriminatorParams {
+  float power_silence_start = -100; // A silence starts at this power, dbFS...
+  float power_silence_end = -75;    // ...and ends at this, also dbFS.
+  size_t power_window = MSEC2WAVF(50); // Samples per power calculation, and the step between them.
+  // Decay factors for the running mean & variance of power velocity, and how many stdevs above the mean it has to go to
+  // count as a transition.
+  float power_a_mean = 0.99, power_a_var = 0.97, power_thresh_sigma = 1.6;
+  // The same, for MFCC velocity.
+  float mfcc_a_mean = 0.95, mfcc_a_var = 0.999, mfcc_thresh_sigma = 2.3;
+};
+
+// Skip this many msec at the start - one of those things I don't think is actually needed but am scared to remove.
+const int POWER_TRANSITION_SKIP_LEAD = 30;
+
 // Return values are pairs of (silence start, silence end) msec timestamps.
-std::vector<std::pair<uint32_t, uint32_t>> discriminate_silence_periods(const int16_t *audio, uint32_t length_msec);
+std::vector<std::pair<uint32_t, uint32_t>> discriminate_silence_periods(const int16_t *audio, uint32_t length_msec,
+                                                                        const DiscriminatorParams &params = {});
+
+// Return values are a msec offset from start_msec. mfcc has mfcc_frames rows - without any, only power is used.
+std::vector<uint32_t> discriminate_transitions(const int16_t *audio, const mfcc_t *const *mfcc, size_t mfcc_frames,
+                                               uint32_t length_msec, const DiscriminatorParams &params = {});
+
+// Online versions of the power-based detectors above, fed one window at a time as audio arrives.
+// window_end points one past the last of params.power_window samples.
+class SilenceDetector {
+public:
+  SilenceDetector(const DiscriminatorParams &params = {}) : _params(params) {}
+  // Returns true if a silence finished with this window, storing its bounds in silence.
+  bool Push(const int16_t *window_end, uint32_t window_end_msec, std::pair<uint32_t, uint32_t> &silence);
+  bool InSilence() const { return _in_silence; }
+  uint32_t SilenceStart() const { return _silence_start; }
+
+private:
+  DiscriminatorParams _params;
+  bool _in_silence = false;
+  uint32_t _silence_start = 0;
+};
+
+class PowerTransitionDetector {
+public:
+  PowerTransitionDetector(const DiscriminatorParams &params = {}) : _params(params) {}
+  // Returns true if a transition starts at the beginning of this window.
+  bool Push(const int16_t *window_end);
 
-// Return values are a msec offset from start_msec.
-std::vector<uint32_t> discriminate_transitions(const int16_t *audio, mfcc_t **mfcc, uint32_t length_msec);
+private:
+  DiscriminatorParams _params;
+  float _last_power = 0;
+  float _mean_power_vel = 0;
+  float _m2_power_vel = 0;
+  int _n_samples = 0;
+  bool _in_peak = false;
+};
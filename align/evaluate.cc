@@ -0,0 +1,112 @@
+#include "evaluation.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+static void print_evaluation(const Evaluation &evaluation) {
+  printf("%-20s %8zu %8zu %8zu %8zu %7.2f%% %8.1f %8.1f %6u %6u %8.1f %8.1f %6u %6u\n", evaluation.name.c_str(),
+         evaluation.ayah_ct, evaluation.missing_ayah_ct, evaluation.extra_ayah_ct, evaluation.fallback_ayah_ct,
+         evaluation.word_ct ? 100.0 * evaluation.individually_segmented_ct / evaluation.word_ct : 0.0,
+         evaluation.start_error.Mean(), evaluation.start_error.Stdev(), evaluation.start_error.Percentile(0.5),
+         evaluation.start_error.Percentile(0.9), evaluation.end_error.Mean(), evaluation.end_error.Stdev(),
+         evaluation.end_error.Percentile(0.5), evaluation.end_error.Percentile(0.9));
+}
+
+int main(int argc, char *argv[]) {
+  std::vector<std::string> args;
+  unsigned int thread_ct = std::thread::hardware_concurrency() ? std::thread::hardware_concurrency() : 4;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg(argv[i]);
+    if (arg.compare(0, 10, "--threads=") == 0) {
+      thread_ct = std::max(1, atoi(arg.c_str() + 10));
+    } else {
+      args.push_back(arg);
+    }
+  }
+  if (args.empty() || args.size() % 2) {
+    std::cerr << argv[0] << " [--threads=N] ours.json reference.json [ours.json reference.json etc.]" << std::endl;
+    std::cerr << "  Compares align output against reference timings in the same format - both in surah/ayah order,"
+              << std::endl;
+    std::cerr << "  as align writes them. Each pair is summarized on a line of its own, named after ours.json."
+              << std::endl;
+    std::cerr << std::endl << "Columns:" << std::endl;
+    std::cerr << "  ayah/missing/extra: ayat in both, only in the reference, only in ours" << std::endl;
+    std::cerr << "  fallback: ayat we only split evenly" << std::endl;
+    std::cerr << "  indiv: reference words we gave a span of their own" << std::endl;
+    std::cerr << "  start/end mean, sd, p50, p90: msec error of span boundaries, where both have a span covering"
+              << std::endl;
+    std::cerr << "    exactly the same words" << std::endl;
+    std::cerr << std::endl << "--sweep output gets a line per setting, named ours/0, ours/1 etc., with each setting's"
+              << std::endl;
+    std::cerr << "params listed after the table - and an All line per setting, over every pair." << std::endl;
+    exit(1);
+  }
+
+  // Each pair is streamed independently, so they're shared out between threads a pair at a time.
+  // Per pair, one per --sweep setting (or just the one).
+  std::vector<std::vector<Evaluation>> evaluations(args.size() / 2);
+  std::vector<std::string> errors(evaluations.size());
+  std::atomic<size_t> next_pair(0);
+  std::vector<std::thread> threads;
+  for (unsigned int i = 0; i < std::min((size_t)thread_ct, evaluations.size()); ++i) {
+    threads.emplace_back([&] {
+      for (size_t pair = next_pair++; pair < evaluations.size(); pair = next_pair++) {
+        try {
+          evaluations[pair] = evaluate_results(args[pair * 2], args[pair * 2 + 1]);
+        } catch (const std::exception &e) {
+          errors[pair] = e.what();
+        }
+      }
+    });
+  }
+  for (auto thread = threads.begin(); thread != threads.end(); thread++) {
+    thread->join();
+  }
+
+  printf("%-20s %8s %8s %8s %8s %8s %8s %8s %6s %6s %8s %8s %6s %6s\n", "", "ayah", "missing", "extra", "fallback",
+         "indiv", "start", "sd", "p50", "p90", "end", "sd", "p50", "p90");
+  // By setting, across pairs.
+  std::vector<Evaluation> totals;
+  std::vector<std::string> params_legend;
+  bool failed = false;
+  for (size_t pair = 0; pair < evaluations.size(); ++pair) {
+    if (!errors[pair].empty()) {
+      std::cerr << errors[pair] << std::endl;
+      failed = true;
+      continue;
+    }
+    std::string name = args[pair * 2].substr(args[pair * 2].find_last_of('/') + 1);
+    name = name.substr(0, name.find_last_of('.'));
+    for (size_t setting = 0; setting < evaluations[pair].size(); ++setting) {
+      auto &evaluation = evaluations[pair][setting];
+      evaluation.name = name;
+      if (!evaluation.params.empty()) {
+        evaluation.name += "/" + std::to_string(setting);
+        params_legend.push_back(evaluation.name + ": " + evaluation.params);
+      }
+      print_evaluation(evaluation);
+      if (totals.size() <= setting) {
+        totals.resize(setting + 1);
+        totals.back().name = totals.size() > 1 || !evaluation.params.empty() ? "All/" + std::to_string(setting) : "All";
+      }
+      totals[setting] += evaluation;
+    }
+  }
+  if (evaluations.size() > 1) {
+    for (auto total = totals.begin(); total != totals.end(); total++) {
+      print_evaluation(*total);
+    }
+  }
+  if (!params_legend.empty()) {
+    printf("\n");
+    for (auto line = params_legend.begin(); line != params_legend.end(); line++) {
+      printf("%s\n", line->c_str());
+    }
+  }
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,200 @@
+#include "evaluation.h"
+#include "result_stream.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+#include <tuple>
+
+// std::min takes these by reference, so they need defining somewhere.
+const unsigned int ErrorDistribution::BIN_MSEC;
+const unsigned int ErrorDistribution::BIN_CT;
+
+void ErrorDistribution::Add(unsigned int error_msec) {
+  _bins[std::min(error_msec / BIN_MSEC, BIN_CT)]++;
+  _count++;
+  _sum += error_msec;
+  _sum_sq += (double)error_msec * error_msec;
+}
+
+ErrorDistribution &ErrorDistribution::operator+=(const ErrorDistribution &other) {
+  for (size_t i = 0; i < _bins.size(); ++i) {
+    _bins[i] += other._bins[i];
+  }
+  _count += other._count;
+  _sum += other._sum;
+  _sum_sq += other._sum_sq;
+  return *this;
+}
+
+double ErrorDistribution::Mean() const {
+  return _count ? _sum / _count : 0;
+}
+
+double ErrorDistribution::Stdev() const {
+  if (!_count) {
+    return 0;
+  }
+  double mean = Mean();
+  return std::sqrt(std::max(0.0, _sum_sq / _count - mean * mean));
+}
+
+unsigned int ErrorDistribution::Percentile(double fraction) const {
+  uint64_t target = std::ceil(fraction * _count), seen = 0;
+  for (size_t i = 0; i < _bins.size(); ++i) {
+    seen += _bins[i];
+    if (seen >= target && seen) {
+      return (i + 1) * BIN_MSEC;
+    }
+  }
+  return 0;
+}
+
+Evaluation &Evaluation::operator+=(const Evaluation &other) {
+  ayah_ct += other.ayah_ct;
+  missing_ayah_ct += other.missing_ayah_ct;
+  extra_ayah_ct += other.extra_ayah_ct;
+  fallback_ayah_ct += other.fallback_ayah_ct;
+  word_ct += other.word_ct;
+  individually_segmented_ct += other.individually_segmented_ct;
+  matching_span_ct += other.matching_span_ct;
+  start_error += other.start_error;
+  end_error += other.end_error;
+  return *this;
+}
+
+// (start word index, end word index, start msec, end msec), ordered by words.
+typedef std::tuple<unsigned int, unsigned int, unsigned int, unsigned int> Span;
+
+static std::vector<Span> result_spans(const nlohmann::json &result) {
+  std::vector<Span> spans;
+  if (result.count("segments") && result["segments"].is_array()) {
+    for (auto segment = result["segments"].begin(); segment != result["segments"].end(); segment++) {
+      spans.emplace_back(segment->at(0).get<unsigned int>(), segment->at(1).get<unsigned int>(),
+                         segment->at(2).get<unsigned int>(), segment->at(3).get<unsigned int>());
+    }
+  }
+  std::sort(spans.begin(), spans.end());
+  return spans;
+}
+
+static void compare_ayah(const nlohmann::json &ours, const nlohmann::json &reference, Evaluation &evaluation) {
+  evaluation.ayah_ct++;
+  if (ours.count("fallback") && ours["fallback"].get<bool>()) {
+    evaluation.fallback_ayah_ct++;
+  }
+  auto our_spans = result_spans(ours), ref_spans = result_spans(reference);
+  unsigned int word_ct = 0;
+  for (auto span = ref_spans.begin(); span != ref_spans.end(); span++) {
+    word_ct = std::max(word_ct, std::get<1>(*span));
+  }
+  evaluation.word_ct += word_ct;
+
+  auto ref_span = ref_spans.begin();
+  for (auto span = our_spans.begin(); span != our_spans.end(); span++) {
+    if (std::get<1>(*span) - std::get<0>(*span) == 1 && std::get<0>(*span) < word_ct) {
+      evaluation.individually_segmented_ct++;
+    }
+    while (ref_span != ref_spans.end() && std::make_pair(std::get<0>(*ref_span), std::get<1>(*ref_span)) <
+                                              std::make_pair(std::get<0>(*span), std::get<1>(*span))) {
+      ref_span++;
+    }
+    if (ref_span == ref_spans.end()) {
+      continue;
+    }
+    if (std::get<0>(*ref_span) == std::get<0>(*span) && std::get<1>(*ref_span) == std::get<1>(*span)) {
+      evaluation.matching_span_ct++;
+      evaluation.start_error.Add(std::abs((int)std::get<2>(*span) - (int)std::get<2>(*ref_span)));
+      evaluation.end_error.Add(std::abs((int)std::get<3>(*span) - (int)std::get<3>(*ref_span)));
+    }
+  }
+}
+
+// Reads the next of a sequence of results into result, returning false once there are none left.
+typedef std::function<bool(nlohmann::json &result)> ResultSource;
+
+static Evaluation compare_results(const ResultSource &ours_source, const std::string &ours_path,
+                                  const std::string &reference_path) {
+  std::ifstream ref_file(reference_path);
+  if (!ref_file.good()) {
+    throw std::runtime_error("Couldn't open " + reference_path);
+  }
+  ResultStreamReader ref_reader(ref_file);
+  ResultSource ref_source = [&](nlohmann::json &result) { return ref_reader.Next(result); };
+  // Reads the next result, making sure we're not going backwards.
+  auto next = [](const ResultSource &source, nlohmann::json &result, unsigned int &key, const std::string &path) {
+    unsigned int last_key = key;
+    if (!source(result)) {
+      return false;
+    }
+    key = result_key(result);
+    if (key < last_key) {
+      throw std::runtime_error(path + " isn't in surah/ayah order");
+    }
+    return true;
+  };
+
+  Evaluation evaluation;
+  nlohmann::json ours, reference;
+  unsigned int our_key = 0, ref_key = 0;
+  bool have_ours = next(ours_source, ours, our_key, ours_path);
+  bool have_ref = next(ref_source, reference, ref_key, reference_path);
+  while (have_ours || have_ref) {
+    if (have_ours && have_ref && our_key == ref_key) {
+      compare_ayah(ours, reference, evaluation);
+      have_ours = next(ours_source, ours, our_key, ours_path);
+      have_ref = next(ref_source, reference, ref_key, reference_path);
+    } else if (have_ours && (!have_ref || our_key < ref_key)) {
+      evaluation.extra_ayah_ct++;
+      have_ours = next(ours_source, ours, our_key, ours_path);
+    } else {
+      evaluation.missing_ayah_ct++;
+      have_ref = next(ref_source, reference, ref_key, reference_path);
+    }
+  }
+  return evaluation;
+}
+
+std::vector<Evaluation> evaluate_results(const std::string &ours_path, const std::string &reference_path) {
+  std::ifstream ours_file(ours_path);
+  if (!ours_file.good()) {
+    throw std::runtime_error("Couldn't open " + ours_path);
+  }
+  ResultStreamReader ours_reader(ours_file);
+  nlohmann::json first;
+  bool have_first = ours_reader.Next(first);
+  if (!have_first || !first.count("params")) {
+    // Plain results, streamed - first is just the first of them.
+    ResultSource ours_source = [&](nlohmann::json &result) {
+      if (have_first) {
+        have_first = false;
+        result = first;
+        return true;
+      }
+      return ours_reader.Next(result);
+    };
+    return std::vector<Evaluation>(1, compare_results(ours_source, ours_path, reference_path));
+  }
+
+  // --sweep output: each member is a setting's params and its results array, which are scored in turn.
+  std::vector<Evaluation> evaluations;
+  nlohmann::json setting = first;
+  do {
+    if (!setting.count("params") || !setting.count("results") || !setting["results"].is_array()) {
+      throw std::runtime_error(ours_path + " has a --sweep setting without params and results");
+    }
+    const nlohmann::json &results = setting["results"];
+    auto result = results.begin();
+    ResultSource ours_source = [&](nlohmann::json &next_result) {
+      if (result == results.end()) {
+        return false;
+      }
+      next_result = *result++;
+      return true;
+    };
+    evaluations.push_back(compare_results(ours_source, ours_path, reference_path));
+    evaluations.back().params = setting["params"].dump();
+  } while (ours_reader.Next(setting));
+  return evaluations;
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Distribution of boundary errors, msec. Kept as a histogram so memory doesn't grow with the amount of data.
+class ErrorDistribution {
+public:
+  static const unsigned int BIN_MSEC = 10;
+  static const unsigned int BIN_CT = 500; // Anything past BIN_CT * BIN_MSEC lands in the last bin.
+
+  ErrorDistribution() : _bins(BIN_CT + 1) {}
+  void Add(unsigned int error_msec);
+  ErrorDistribution &operator+=(const ErrorDistribution &other);
+  uint64_t Count() const { return _count; }
+  double Mean() const;
+  double Stdev() const;
+  // Upper edge of the bin containing the given fraction (0-1) of errors.
+  unsigned int Percentile(double fraction) const;
+
+private:
+  std::vector<uint64_t> _bins;
+  uint64_t _count = 0;
+  double _sum = 0, _sum_sq = 0;
+};
+
+// How one set of results compares to a reference - e.g. one qari's output against ElMohafez's timings.
+struct Evaluation {
+  std::string name;
+  std::string params;                     // The --sweep setting's params as JSON, if these results came from one.
+  size_t ayah_ct = 0;                     // Ayat in both.
+  size_t missing_ayah_ct = 0;             // Reference ayat we have no result for.
+  size_t extra_ayah_ct = 0;               // Ayat we have that the reference doesn't.
+  size_t fallback_ayah_ct = 0;            // Of ayah_ct, how many we only split evenly.
+  size_t word_ct = 0;                     // Reference words in the ayat in both.
+  size_t individually_segmented_ct = 0;   // Of word_ct, how many we gave a span to themselves.
+  size_t matching_span_ct = 0;            // Spans covering the same words in both, which the errors are taken from.
+  ErrorDistribution start_error, end_error;
+  Evaluation &operator+=(const Evaluation &other);
+};
+
+// Walks both result files (JSON, in surah/ayah order, as align writes them) in step, comparing spans that cover the
+// same words. Only the current ayah of each is ever in memory - or with --sweep output for ours, one setting's results
+// at a time, each compared against the whole reference in turn. Returns one Evaluation per setting (just the one
+// without --sweep). Throws on input that isn't in either shape.
+std::vector<Evaluation> evaluate_results(const std::string &ours_path, const std::string &reference_path);
@@ -1,58 +1,89 @@
+#include "admission.h"
+#include "affinity.h"
+#include "audio_decode.h"
+#include "corpus.h"
 #include "debug.h"
+#include "err.h"
+#include "manifest.h"
+#include "merge.h"
+#include "metrics.h"
+#include "params.h"
+#include "pipeline.h"
+#include "prefetch.h"
+#include "rates.h"
 #include "segment.h"
+#include "server.h"
+#include "shard.h"
+#include "stream.h"
+#include "timing_writer.h"
 #include "vendor/json.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
 #include <ctime>
 #include <fstream>
 #include <iostream>
+#include <list>
+#include <memory>
 #include <mutex>
 #include <queue>
 #include <set>
-#include <sstream>
 #include <thread>
 #include <tuple>
-#include <unistd.h>
 #include <unordered_map>
+#include <unistd.h>
 
-// http://stackoverflow.com/a/236803
-static void split(const std::string &s, char delim, std::vector<std::string> &elems) {
-  std::stringstream ss;
-  ss.str(s);
-  std::string item;
-  while (std::getline(ss, item, delim)) {
-    elems.push_back(item);
-  }
-}
-
-static void collapse_muqataat(SegmentationResult &result) {
-  // Muqata'at are represented in the recognition model as discrete words.
-  // This has turned out to be an inconvenient decision, regardless of its merits.
-  // We collapse them back into a single word here, triggered by the fact they are
-  // of form  __...__ in the reference text.
-  std::vector<SegmentedWordSpan> original_spans;
-  original_spans.swap(result.spans);
-  int collapsed_muqataat = 0;
-  for (auto span = original_spans.begin(); span != original_spans.end(); span++) {
-    if ((collapsed_muqataat && result.job.in_words[span->index_start].size() == 0) ||
-        result.job.in_words[span->index_start][0] == '_') {
-      if (!collapsed_muqataat) {
-        span->index_end = 1;
-        result.spans.push_back(*span);
-      }
-      result.spans.back().end = span->end;
-      collapsed_muqataat++;
+// Pulls --name[=value] options out of argv; everything else is returned in order as positional arguments.
+static std::unordered_map<std::string, std::string> parse_options(int argc, char *argv[],
+                                                                  std::vector<std::string> &positional) {
+  std::unordered_map<std::string, std::string> options;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg(argv[i]);
+    if (arg.compare(0, 2, "--") != 0) {
+      positional.push_back(arg);
+      continue;
+    }
+    auto eq = arg.find('=');
+    if (eq == std::string::npos) {
+      options[arg.substr(2)] = "";
     } else {
-      if (collapsed_muqataat) {
-        span->index_start -= collapsed_muqataat - 1;
-        span->index_end -= collapsed_muqataat - 1;
-      }
-      result.spans.push_back(*span);
+      options[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
     }
   }
+  return options;
 }
 
-static void job_executor(std::string ps_cfg, std::queue<SegmentationJob *> &jobs, std::mutex &jobs_mtx,
-                         std::vector<SegmentationResult> &results) {
-  SegmentationProcessor seg_proc(ps_cfg);
+// A job, plus whose model to decode it with.
+struct BatchJob {
+  SegmentationJob job;
+  unsigned int reciter;
+  size_t queue_pos; // For AudioDecodeStage::Take.
+  unsigned int estimated_msec; // job_audio_msec before any decoding, for the ETA.
+};
+
+struct BatchResult {
+  unsigned int reciter;
+  unsigned int setting; // Index into the --sweep grid, if any.
+  SegmentationResult result;
+};
+
+// How many reciters' decoders each worker keeps around. Jobs are queued grouped by reciter, so workers only switch
+// models at the boundaries.
+const size_t MODEL_CACHE_SIZE = 2;
+
+// How many ayat of decoded MP3 audio AudioDecodeStage keeps ready, per worker.
+const size_t DECODE_AHEAD_PER_WORKER = 2;
+
+static void job_executor(const std::vector<Reciter> &reciters, const std::vector<size_t> &decoder_bytes,
+                         const TierConfig &tiers, const SegmentationParams &params,
+                         const std::vector<SegmentationParams> &sweep, std::queue<BatchJob *> &jobs,
+                         std::mutex &jobs_mtx, AudioPrefetcher &prefetcher, AudioDecodeStage &decode_stage,
+                         AdmissionController &admission, Metrics &metrics, DictionaryCache &dicts,
+                         std::vector<BatchResult> &results, TierStats &tier_stats) {
+  // Most recently used first.
+  std::list<std::pair<unsigned int, std::unique_ptr<SegmentationProcessor>>> processors;
   while (true) {
     std::unique_lock<std::mutex> jobs_lock(jobs_mtx);
     if (jobs.empty()) {
@@ -61,135 +92,531 @@ static void job_executor(std::string ps_cfg, std::queue<SegmentationJob *> &jobs
     auto job = jobs.front();
     jobs.pop();
     jobs_lock.unlock();
-    DEBUG("Proc " << job->in_file);
-    auto result = seg_proc.Run(*job);
-    collapse_muqataat(result);
-    results.push_back(result);
-    if (job->in_words.size() != result.spans.size()) {
-      DEBUG("Mismatched word count! Ref " << job->in_words.size() << " matched " << result.spans.size() << " spans");
-      for (auto i = result.spans.begin(); i != result.spans.end(); i++) {
-        DEBUG(i->start << "~" << i->end << " words " << i->index_start << "~" << i->index_end);
+    prefetcher.Advance();
+    metrics.JobStarted();
+    DEBUG("Proc " << job->job.in_file);
+
+    auto seg_proc = processors.begin();
+    while (seg_proc != processors.end() && seg_proc->first != job->reciter) {
+      seg_proc++;
+    }
+    auto phase_start = std::chrono::steady_clock::now();
+    auto end_phase = [&](Phase phase) {
+      auto now = std::chrono::steady_clock::now();
+      metrics.AddPhaseTime(phase, std::chrono::duration<double>(now - phase_start).count());
+      phase_start = now;
+    };
+    if (seg_proc == processors.end()) {
+      processors.emplace_front(job->reciter,
+                               std::unique_ptr<SegmentationProcessor>(
+                                   new SegmentationProcessor(reciters[job->reciter].ps_cfg, params,
+                                                             dicts.Get(reciters[job->reciter].ps_cfg))));
+      admission.AddResident(decoder_bytes[job->reciter]);
+      if (processors.size() > MODEL_CACHE_SIZE) {
+        admission.RemoveResident(decoder_bytes[processors.back().first]);
+        processors.pop_back();
       }
+      end_phase(Phase::Load);
+    } else {
+      processors.splice(processors.begin(), processors, seg_proc);
+    }
+
+    std::vector<int16_t> pcm;
+    try {
+      if (is_compressed_audio(job->job.in_file)) {
+        pcm = decode_stage.Take(job->queue_pos);
+        job->job.in_audio = pcm.data();
+        job->job.in_audio_samples = pcm.size();
+      }
+    } catch (const std::exception &e) {
+      std::cerr << std::endl << "Failed " << job->job.in_file << ": " << e.what() << std::endl;
+      metrics.JobFinished(0, true, job->estimated_msec);
+      continue;
     }
+    end_phase(Phase::Decode);
+
+    size_t job_bytes = estimate_job_memory(job->job);
+    admission.AdmitJob(job_bytes);
+    end_phase(Phase::Admit);
+    bool failed = false;
+    try {
+      if (sweep.empty()) {
+        results.push_back({job->reciter, 0, process_job(*processors.front().second, job->job, tiers, tier_stats)});
+      } else {
+        auto sweep_results = process_job_sweep(*processors.front().second, job->job, tiers, sweep, tier_stats);
+        for (unsigned int setting = 0; setting < sweep_results.size(); ++setting) {
+          results.push_back({job->reciter, setting, sweep_results[setting]});
+        }
+      }
+    } catch (const std::exception &e) {
+      std::cerr << std::endl << "Failed " << job->job.in_file << ": " << e.what() << std::endl;
+      failed = true;
+    }
+    admission.FinishJob(job_bytes);
+    end_phase(Phase::Align);
+    metrics.JobFinished(failed ? 0 : job_audio_msec(job->job), failed, job->estimated_msec);
+    job->job.in_audio = NULL;
+  }
+  for (auto seg_proc = processors.begin(); seg_proc != processors.end(); seg_proc++) {
+    admission.RemoveResident(decoder_bytes[seg_proc->first]);
   }
 }
 
+// Aligns raw PCM from stdin as it arrives, writing word boundary events to stdout as JSON lines.
+static int run_follow(const Corpus &corpus, const std::string &ps_cfg, const SegmentationParams &params,
+                      unsigned short surah, unsigned short ayah, unsigned int hold_back_msec) {
+  SegmentationProcessor seg_proc(ps_cfg, params);
+  auto job = corpus.MakeJob(surah, ayah, "-");
+  StreamingSegmenter segmenter(seg_proc, job, hold_back_msec);
+  auto write_events = [](const std::vector<WordEvent> &events) {
+    for (auto event = events.begin(); event != events.end(); event++) {
+      nlohmann::json event_json;
+      event_json["word"] = event->index;
+      event_json[event->kind == WordEvent::Start ? "start" : "end"] = event->msec;
+      std::cout << event_json << std::endl;
+    }
+  };
+  // 50msec at a time - each chunk's a new hypothesis to compare, so this is what most of the latency's made of.
+  std::vector<int16_t> chunk(MSEC2WAVF(50));
+  size_t samples_read;
+  while ((samples_read = fread(chunk.data(), sizeof(int16_t), chunk.size(), stdin)) > 0) {
+    write_events(segmenter.Feed(chunk.data(), samples_read));
+  }
+  write_events(segmenter.Finish());
+  return 0;
+}
+
 int main(int argc, char *argv[]) {
-  if (argc < 5) {
-    std::cerr << argv[0] << " quran.txt quran.liaise.txt ps.cfg ..._sssaaa.wav [..._sssaaa.wav etc.]" << std::endl;
+  std::vector<std::string> args;
+  auto options = parse_options(argc, argv, args);
+  if (options.count("merge")) {
+    if (args.empty()) {
+      std::cerr << argv[0] << " --merge results.json [results.json etc.]" << std::endl;
+      std::cerr << "  Combines --shard outputs into one surah/ayah-ordered array on stdout." << std::endl;
+      exit(1);
+    }
+    try {
+      merge_results(args, std::cout);
+    } catch (const std::exception &e) {
+      std::cerr << e.what() << std::endl;
+      exit(1);
+    }
+    return 0;
+  }
+
+  const bool serve = options.count("serve");
+  const bool follow = options.count("follow");
+  const bool manifest = options.count("manifest");
+  if (args.size() < (manifest ? 2 : serve || follow ? 3 : 4)) {
+    std::cerr << argv[0] << " [options] quran.txt quran.liaise.txt ps.cfg ..._sssaaa.wav [..._sssaaa.wav/mp3 etc.]"
+              << std::endl;
+    std::cerr << argv[0] << " --serve [options] quran.txt quran.liaise.txt ps.cfg" << std::endl;
+    std::cerr << argv[0] << " --manifest=reciters.txt [options] quran.txt quran.liaise.txt" << std::endl;
+    std::cerr << argv[0] << " --merge results.json [results.json etc.]" << std::endl;
+    std::cerr << argv[0] << " --follow=sss:aaa [options] quran.txt quran.liaise.txt ps.cfg < audio.raw" << std::endl;
     std::cerr << "  quran.txt is the input used to generate the recognition LM (Tanzil.net format)" << std::endl;
     std::cerr << "  quran.liaise.txt is the list of surah-ayah-wordindex-flags that require transition "
                  "discrimination (set flags field to 1 to start)";
     std::cerr << "  ps.cfg is the full phonetic dictionary from said LM, used in training the AM" << std::endl;
-    std::cerr << "  .wav files are EveryAyah recitation audio clips" << std::endl;
+    std::cerr << "  .wav files are EveryAyah recitation audio clips - or .mp3, if ffmpeg is on the PATH to decode them"
+              << std::endl;
     std::cerr << std::endl << "Output is JSON. Each member of `segments` is a tuple:" << std::endl;
     std::cerr << "  (start word index, end word index, start time msec, end time msec)" << std::endl;
     std::cerr << "  Segments may contain multiple words. Indexes are on splitting input text by spaces." << std::endl;
+    std::cerr << std::endl << "Options:" << std::endl;
+    std::cerr << "  --no-fast-pass      decode every ayah with the ps.cfg beams, rather than trying a pruned pass first"
+              << std::endl;
+    std::cerr << "  --retry-errors=N    rerun at full beam if the fast pass has more than N matcher errors"
+              << std::endl;
+    std::cerr << "                        (default 1)" << std::endl;
+    std::cerr << "  --retry-unmatched=N rerun at full beam if the fast pass leaves more than N words inexact"
+              << std::endl;
+    std::cerr << "                        (default 1)" << std::endl;
+    std::cerr << "  --budget=X          give up decoding after 10s + X times the audio length, retrying with the fast"
+              << std::endl;
+    std::cerr << "                        beam, then splitting evenly (flagged \"fallback\" in the output); default 5,"
+              << std::endl;
+    std::cerr << "                        0 to wait forever" << std::endl;
+    std::cerr << "  --serve             read jobs as JSON lines on stdin, writing each result to stdout when done:"
+              << std::endl;
+    std::cerr << "                        {\"id\": ..., \"surah\": 1, \"ayah\": 1, \"audio\": \"path.wav\"}"
+              << std::endl;
+    std::cerr << "                        (or \"pcm\": base64 16kHz mono s16le samples in place of \"audio\")"
+              << std::endl;
+    std::cerr << "  --queue-depth=N     with --serve, stop reading input while N jobs are waiting (default 2/worker)"
+              << std::endl;
+    std::cerr << "  --manifest=PATH     align several reciters in one run, sharing workers between them. Each line of"
+              << std::endl;
+    std::cerr << "                        PATH is \"name ps.cfg audio_dir\", results go to name.json"
+              << std::endl;
+    std::cerr << "  --out-dir=DIR       with --manifest, where to write each reciter's results (default .)"
+              << std::endl;
+    std::cerr << "  --mem-budget=MB     limit workers and jobs in flight so estimated memory use stays under MB"
+              << std::endl;
+    std::cerr << "  --decoders=N        threads decoding .mp3 input ahead of the workers (default 1 + 1/4 per worker)"
+              << std::endl;
+    std::cerr << "  --metrics-file=PATH keep PATH updated with progress counters, in Prometheus text format"
+              << std::endl;
+    std::cerr << "  --pin               pin each worker to a CPU, spread evenly over NUMA nodes, so its decoder's"
+              << std::endl;
+    std::cerr << "                        memory stays local to it" << std::endl;
+    std::cerr << "  --prefetch=N        start reading audio in up to N files ahead of the workers (default 2/worker)"
+              << std::endl;
+    std::cerr << "  --shard=i/N         only process the ayat belonging to shard i (0-based) of N - combine the outputs"
+              << std::endl;
+    std::cerr << "                        of all N with --merge" << std::endl;
+    std::cerr << "  --shard-by=hash|size split shards by ayah hash (default), or balance them by audio file size"
+              << std::endl;
+    std::cerr << "  --params=PATH       override the boundary-refining parameters with PATH's \"name value\" lines"
+              << std::endl;
+    std::cerr << "                        (see params.h for the names)" << std::endl;
+    std::cerr << "  --sweep=PATH        like --params, but each name can list several values. Every combination is"
+              << std::endl;
+    std::cerr << "                        tried from a single decode of each ayah, and the output becomes a list of"
+              << std::endl;
+    std::cerr << "                        {\"params\": {...}, \"results\": [...]}, one per combination" << std::endl;
+    std::cerr << "  --follow=sss:aaa    align 16kHz mono s16le audio from stdin as it arrives, writing JSON lines of"
+              << std::endl;
+    std::cerr << "                        {\"word\": index, \"start\" or \"end\": msec} as boundaries become clear"
+              << std::endl;
+    std::cerr << "  --binary-out=PATH   also write the results to PATH in the compact format read by timing_file.h"
+              << std::endl;
+    std::cerr << "                        (with --manifest, just --binary-out: each reciter's go to name.bin)"
+              << std::endl;
+    std::cerr << "  --hold-back=MSEC    with --follow, how long recognized words must settle before being reported "
+                 "(default 100)"
+              << std::endl;
     exit(1);
   }
 
-  // Load Quran text file.
-  // (Tanzil.net format)
-  std::ifstream quran_file(argv[1]);
-  std::unordered_map<unsigned int, std::string> quran_text;
-  std::string value;
-  while (quran_file.good()) {
-    std::getline(quran_file, value, '|');
-    if (!value.length()) {
-      continue;
+  // Pocketsphinx logs every model load and utterance, which would bury our own output.
+  err_set_logfp(NULL);
+  err_set_debug_level(0);
+
+  TierConfig tiers;
+  tiers.fast_pass = !options.count("no-fast-pass");
+  if (options.count("retry-errors")) {
+    tiers.max_errors = stoi(options["retry-errors"]);
+  }
+  if (options.count("retry-unmatched")) {
+    tiers.max_unmatched = stoi(options["retry-unmatched"]);
+  }
+  if (options.count("budget")) {
+    tiers.budget_factor = stod(options["budget"]);
+  }
+  SegmentationParams params;
+  std::vector<SegmentationParams> sweep;
+  try {
+    if (options.count("params")) {
+      params = load_params(options["params"]);
     }
-    if (value[0] == '#') {
-      std::getline(quran_file, value);
-      continue;
+    if (options.count("sweep")) {
+      sweep = load_param_grid(options["sweep"]);
+    }
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    exit(1);
+  }
+  if (!sweep.empty() && options.count("binary-out")) {
+    std::cerr << "--binary-out only holds one set of results, so can't be used with --sweep" << std::endl;
+    exit(1);
+  }
+
+  Corpus corpus(args[0], args[1]);
+  unsigned int worker_ct = std::thread::hardware_concurrency() ? std::thread::hardware_concurrency() : 4;
+
+  if (follow) {
+    unsigned int surah, ayah;
+    if (sscanf(options["follow"].c_str(), "%u:%u", &surah, &ayah) != 2) {
+      std::cerr << "--follow takes surah:ayah" << std::endl;
+      exit(1);
+    }
+    // As --serve does - otherwise there'd be no words to follow, and nothing would ever come out.
+    if (surah > 999 || ayah > 999 || !corpus.HasAyah(surah, ayah)) {
+      std::cerr << "No such ayah " << options["follow"] << std::endl;
+      exit(1);
     }
-    int surah_ayah_key = stoi(value) * 1000;
-    std::getline(quran_file, value, '|');
-    surah_ayah_key += stoi(value);
-    std::getline(quran_file, value, '\n');
-    quran_text[surah_ayah_key] = value;
+    unsigned int hold_back_msec = options.count("hold-back") ? stoi(options["hold-back"]) : 100;
+    return run_follow(corpus, args[2], params, surah, ayah, hold_back_msec);
   }
-  quran_file.close();
 
-  // Load liaise-point definitions.
-  std::ifstream quran_liaise_file(argv[2]);
-  std::unordered_map<unsigned int, std::vector<LiaisePoint>> liaise_points;
-  while (quran_liaise_file.good()) {
-    uint16_t surah_num, ayah_num, word, flags;
-    quran_liaise_file >> surah_num;
-    quran_liaise_file >> ayah_num;
-    quran_liaise_file >> word;
-    quran_liaise_file >> flags;
-    liaise_points[surah_num * 1000 + ayah_num].push_back({word, (LiaiseFlags)flags});
+  if (serve) {
+    size_t queue_depth = options.count("queue-depth") ? stoi(options["queue-depth"]) : worker_ct * 2;
+    return run_server(corpus, args[2], tiers, params, worker_ct, queue_depth, options["metrics-file"]);
   }
 
-  // Generate jobs and round-robin to worker queues.
-  const unsigned int worker_ct = std::thread::hardware_concurrency() ? std::thread::hardware_concurrency() : 4;
+  // Each reciter's jobs are queued together - see MODEL_CACHE_SIZE.
+  std::vector<Reciter> reciters;
+  if (manifest) {
+    try {
+      reciters = load_manifest(options["manifest"]);
+    } catch (const std::exception &e) {
+      std::cerr << e.what() << std::endl;
+      exit(1);
+    }
+    if (reciters.empty()) {
+      std::cerr << options["manifest"] << " doesn't list any reciters" << std::endl;
+      exit(1);
+    }
+    // Better to find out now than after hours of decoding.
+    std::string out_dir = options.count("out-dir") ? options["out-dir"] : ".";
+    if (access(out_dir.c_str(), W_OK | X_OK) != 0) {
+      std::cerr << "Can't write to --out-dir " << out_dir << ": " << strerror(errno) << std::endl;
+      exit(1);
+    }
+  } else {
+    reciters.push_back({"", args[2], ""});
+    if (options.count("binary-out")) {
+      // Likewise.
+      const std::string &binary_out = options["binary-out"];
+      if (binary_out.empty() || binary_out.back() == '/') {
+        std::cerr << "--binary-out takes a file path" << std::endl;
+        exit(1);
+      }
+      auto slash = binary_out.find_last_of('/');
+      std::string dir = slash == std::string::npos ? "." : binary_out.substr(0, slash + 1);
+      if (access(dir.c_str(), W_OK | X_OK) != 0 ||
+          (access(binary_out.c_str(), F_OK) == 0 && access(binary_out.c_str(), W_OK) != 0)) {
+        std::cerr << "Can't write to --binary-out " << binary_out << ": " << strerror(errno) << std::endl;
+        exit(1);
+      }
+    }
+  }
+
+  // Generate jobs.
   // Jobs need to survive after they're popped from the queue.
   // (since the Result has a ref to it - meh).
-  std::vector<SegmentationJob> jobs;
-  std::queue<SegmentationJob *> job_queue;
-  std::vector<std::vector<SegmentationResult>> worker_results(worker_ct);
-  for (int i = 4; i < argc; ++i) {
-    if (strlen(argv[i]) < 10 || strcmp(strchr(argv[i], 0) - 4, ".wav") != 0) {
-      std::cerr
-          << "Input audio filename must end with sssaaa.wav, where sss is the surah number and aaa the ayah number."
-          << std::endl;
+  std::vector<BatchJob> jobs;
+  std::queue<BatchJob *> job_queue;
+  for (unsigned int reciter = 0; reciter < reciters.size(); ++reciter) {
+    std::vector<std::string> audio_files;
+    if (manifest) {
+      audio_files = list_audio_files(reciters[reciter].audio_dir);
+    } else {
+      audio_files.assign(args.begin() + 3, args.end());
+    }
+    for (auto audio_file = audio_files.begin(); audio_file != audio_files.end(); audio_file++) {
+      unsigned short surah_num, ayah_num;
+      if (!parse_audio_filename(*audio_file, surah_num, ayah_num)) {
+        std::cerr
+            << "Input audio filename must end with sssaaa.wav (or .mp3), where sss is the surah number and aaa the "
+               "ayah number."
+            << std::endl;
+        exit(1);
+      }
+      jobs.push_back({corpus.MakeJob(surah_num, ayah_num, *audio_file), reciter, 0, 0});
+    }
+  }
+
+  if (options.count("shard")) {
+    auto slash = options["shard"].find('/');
+    unsigned int shard = stoi(options["shard"]);
+    unsigned int shard_ct = slash == std::string::npos ? 0 : stoi(options["shard"].substr(slash + 1));
+    if (!shard_ct || shard >= shard_ct) {
+      std::cerr << "--shard takes i/N, with i < N" << std::endl;
       exit(1);
     }
-    unsigned short surah_num = stoi(std::string(argv[i] + strlen(argv[i]) - 10, 3));
-    unsigned short ayah_num = stoi(std::string(argv[i] + strlen(argv[i]) - 7, 3));
-    std::vector<std::string> words;
-    DEBUG("Prep " << quran_text[surah_num * 1000 + ayah_num]);
-    split(quran_text[surah_num * 1000 + ayah_num], ' ', words);
-    jobs.push_back({surah_num, ayah_num, argv[i], words, liaise_points[surah_num * 1000 + ayah_num]});
+    std::vector<const SegmentationJob *> shard_jobs;
+    for (auto job = jobs.begin(); job != jobs.end(); job++) {
+      shard_jobs.push_back(&job->job);
+    }
+    auto assignment = assign_shards(shard_jobs, shard_ct, options["shard-by"] == "size" ? ShardBySize : ShardByHash);
+    std::vector<BatchJob> kept_jobs;
+    for (size_t i = 0; i < jobs.size(); ++i) {
+      if (assignment[i] == shard) {
+        kept_jobs.push_back(jobs[i]);
+      }
+    }
+    jobs.swap(kept_jobs);
   }
 
+  // Only start as many workers as we have memory for decoders, leaving room for the biggest job alongside.
+  const size_t mem_budget = options.count("mem-budget") ? (size_t)stoi(options["mem-budget"]) << 20 : 0;
+  std::vector<size_t> decoder_bytes;
+  // Dictionaries are shared by every worker, so they're counted once per cfg rather than per decoder.
+  size_t dictionary_bytes = 0;
+  std::set<std::string> counted_cfgs;
+  for (auto reciter = reciters.begin(); reciter != reciters.end(); reciter++) {
+    try {
+      decoder_bytes.push_back(SegmentationProcessor::EstimateMemory(reciter->ps_cfg));
+      if (counted_cfgs.insert(reciter->ps_cfg).second) {
+        dictionary_bytes += SegmentationProcessor::EstimateDictionaryMemory(reciter->ps_cfg);
+      }
+    } catch (const std::exception &e) {
+      // Every job of theirs would fail the same way, so there's no sense starting.
+      std::cerr << e.what() << std::endl;
+      exit(1);
+    }
+  }
+  // Each worker has up to DECODE_AHEAD_PER_WORKER ayat of decoded audio waiting for it.
+  size_t max_decoded_bytes = 0;
+  for (auto job = jobs.begin(); job != jobs.end(); job++) {
+    max_decoded_bytes = std::max(max_decoded_bytes, estimate_decoded_audio_memory(job->job));
+  }
+  const size_t worker_decode_bytes = max_decoded_bytes * DECODE_AHEAD_PER_WORKER;
+  if (mem_budget) {
+    size_t max_job_bytes = 0;
+    for (auto job = jobs.begin(); job != jobs.end(); job++) {
+      max_job_bytes = std::max(max_job_bytes, estimate_job_memory(job->job));
+    }
+    // With several reciters, a worker can be holding up to MODEL_CACHE_SIZE decoders at once.
+    size_t worker_bytes = *std::max_element(decoder_bytes.begin(), decoder_bytes.end()) *
+                              std::min(MODEL_CACHE_SIZE, reciters.size()) +
+                          worker_decode_bytes;
+    size_t shared_bytes = max_job_bytes + dictionary_bytes;
+    size_t worker_budget = mem_budget > shared_bytes ? mem_budget - shared_bytes : 0;
+    unsigned int affordable_workers = std::max((size_t)1, worker_budget / std::max((size_t)1, worker_bytes));
+    if (affordable_workers < worker_ct) {
+      std::cerr << "Memory budget only fits " << affordable_workers << " of " << worker_ct << " workers" << std::endl;
+      worker_ct = affordable_workers;
+    }
+  }
+  AdmissionController admission(mem_budget);
+  admission.AddResident(dictionary_bytes + worker_decode_bytes * worker_ct);
+  std::vector<std::vector<BatchResult>> worker_results(worker_ct);
+  std::vector<TierStats> worker_tier_stats(worker_ct);
+
   // Fill job queue.
+  std::vector<std::string> queued_files;
+  uint64_t estimated_msec_total = 0;
   for (auto job = jobs.begin(); job != jobs.end(); job++) {
+    job->queue_pos = queued_files.size();
+    job->estimated_msec = job_audio_msec(job->job);
+    estimated_msec_total += job->estimated_msec;
     job_queue.push(&(*job));
+    queued_files.push_back(job->job.in_file);
+  }
+  AudioPrefetcher prefetcher(queued_files, options.count("prefetch") ? stoi(options["prefetch"]) : worker_ct * 2);
+  // MP3 decoding is a good deal cheaper than recognition, so a few threads keep the workers fed.
+  AudioDecodeStage decode_stage(queued_files, worker_ct * DECODE_AHEAD_PER_WORKER,
+                                options.count("decoders") ? stoi(options["decoders"]) : worker_ct / 4 + 1);
+
+  Metrics metrics;
+  metrics.SetJobsTotal(jobs.size());
+  metrics.SetEstimatedAudioTotal(estimated_msec_total);
+  std::unique_ptr<MetricsFileWriter> metrics_writer;
+  if (options.count("metrics-file")) {
+    metrics_writer.reset(new MetricsFileWriter(metrics, options["metrics-file"]));
+  }
+
+  // With --pin, each worker stays on one CPU, and since workers construct their own decoders, those get allocated on
+  // that CPU's NUMA node, models and all. All workers share the one text dictionary - see DictionaryCache.
+  const bool pin = options.count("pin");
+  auto node_cpus = numa_node_cpus();
+  auto placements = place_workers(node_cpus, worker_ct);
+  DictionaryCache dicts;
+  if (pin) {
+    std::cerr << "Pinning " << worker_ct << " workers across " << node_cpus.size() << " NUMA node(s)" << std::endl;
   }
 
   // Run jobs.
   const std::time_t start_time = time(NULL);
+  const auto run_start = std::chrono::steady_clock::now();
   std::mutex jobs_mtx;
   std::vector<std::thread> worker_threads;
   for (unsigned int i = 0; i < worker_ct; ++i) {
-    worker_threads.emplace_back([&, i] { job_executor(argv[3], job_queue, jobs_mtx, worker_results[i]); });
+    worker_threads.emplace_back([&, i] {
+      if (pin && !pin_current_thread(placements[i].cpu)) {
+        std::cerr << "Couldn't pin worker " << i << " to CPU " << placements[i].cpu << std::endl;
+      }
+      job_executor(reciters, decoder_bytes, tiers, params, sweep, job_queue, jobs_mtx, prefetcher, decode_stage,
+                   admission, metrics, dicts, worker_results[i], worker_tier_stats[i]);
+    });
   }
-  // Spin and display progress.
+  // Display progress as jobs finish - and at least once a second, to keep the clock ticking.
+  size_t finished_jobs = 0;
   do {
+    finished_jobs = metrics.WaitForProgress(finished_jobs, std::chrono::milliseconds(1000));
     unsigned int elapsed_seconds = time(NULL) - start_time;
-    int completed_jobs = jobs.size() - job_queue.size();
-    float jobs_per_second = elapsed_seconds ? (float)completed_jobs / (float)elapsed_seconds : 9999;
-    unsigned int secs_remaining = (float)job_queue.size() / jobs_per_second;
-    std::cerr << "\33[2K\rDone " << completed_jobs << "/" << jobs.size() << " ayah (" << elapsed_seconds
-              << " seconds elapsed, " << secs_remaining << " to go)";
-    sleep(1);
-  } while (job_queue.size());
-  std::cerr << std::endl << "Waiting for last jobs to finish..." << std::endl;
-  // Wait for jobs to really finish.
+    // By audio rather than ayat, which range from a couple of seconds to several minutes.
+    double fraction_done = metrics.EstimatedAudioFraction();
+    unsigned int secs_remaining = fraction_done > 0 ? elapsed_seconds * (1 - fraction_done) / fraction_done : 0;
+    std::cerr << "\33[2K\rDone " << metrics.JobsDone() << "/" << jobs.size() << " ayah";
+    if (metrics.JobsFailed()) {
+      std::cerr << ", " << metrics.JobsFailed() << " failed";
+    }
+    std::cerr << " (" << metrics.JobsInflight() << " in progress, "
+              << (elapsed_seconds ? (unsigned int)(metrics.AudioSecs() / elapsed_seconds) : 0)
+              << "x realtime, " << elapsed_seconds << " seconds elapsed, " << secs_remaining << " to go)";
+  } while (finished_jobs < jobs.size());
+  std::cerr << std::endl;
   for (unsigned int i = 0; i < worker_ct; ++i) {
     worker_threads[i].join();
   }
 
-  // Serialize results to JSON.
-  nlohmann::json results_json;
+  TierStats tier_totals;
+  for (auto stats = worker_tier_stats.begin(); stats != worker_tier_stats.end(); stats++) {
+    tier_totals += *stats;
+  }
+  std::cerr << "Fast pass: " << tier_totals.fast_ct << " ayah in " << tier_totals.fast_secs << " decoder-seconds"
+            << std::endl;
+  std::cerr << "Full beam: " << tier_totals.full_ct << " ayah (" << tier_totals.retry_ct << " retried, "
+            << tier_totals.retry_improved_ct << " improved by it) in " << tier_totals.full_secs << " decoder-seconds"
+            << std::endl;
+  std::cerr << "Over budget: " << tier_totals.timeout_ct << " decodes, " << tier_totals.fallback_ct
+            << " ayah split evenly" << std::endl;
+  std::cerr << "Memory: estimated peak " << (admission.PeakEstimate() >> 20) << " MB, actual peak RSS "
+            << (peak_rss() >> 20) << " MB" << std::endl;
+  double run_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - run_start).count();
+  std::cerr << "Throughput: " << metrics.JobsDone() / run_secs << " ayah/s, " << metrics.AudioSecs() / run_secs
+            << " audio-seconds/s (" << (pin ? "pinned" : "unpinned") << ")" << std::endl;
+
+  // Put results back in surah/ayah order, regardless of which worker they landed on.
+  // Indexed by reciter, then --sweep setting.
+  const size_t setting_ct = std::max((size_t)1, sweep.size());
+  std::vector<std::vector<std::vector<const SegmentationResult *>>> ordered_results(
+      reciters.size(), std::vector<std::vector<const SegmentationResult *>>(setting_ct));
   for (unsigned int i = 0; i < worker_ct; ++i) {
     for (auto result = worker_results[i].begin(); result != worker_results[i].end(); result++) {
-      nlohmann::json result_json;
-      result_json["surah"] = result->job.surah;
-      result_json["ayah"] = result->job.ayah;
-      result_json["stats"] = nlohmann::json();
-      result_json["stats"]["insertions"] = result->stats.insertions;
-      result_json["stats"]["deletions"] = result->stats.deletions;
-      result_json["stats"]["transpositions"] = result->stats.transpositions;
-      for (auto span = result->spans.begin(); span != result->spans.end(); span++) {
-        result_json["segments"].push_back({span->index_start, span->index_end, span->start, span->end});
-      }
-      results_json.push_back(result_json);
+      ordered_results[result->reciter][result->setting].push_back(&result->result);
     }
   }
+  bool write_failed = false;
+  for (unsigned int reciter = 0; reciter < reciters.size(); ++reciter) {
+    for (auto setting = ordered_results[reciter].begin(); setting != ordered_results[reciter].end(); setting++) {
+      std::stable_sort(setting->begin(), setting->end(), [](const SegmentationResult *a, const SegmentationResult *b) {
+        return std::make_pair(a->job.surah, a->job.ayah) < std::make_pair(b->job.surah, b->job.ayah);
+      });
+    }
 
-  std::cout << results_json;
-  return 0;
+    std::string out_base = options.count("out-dir") ? options["out-dir"] + "/" : "";
+    out_base += reciters[reciter].name;
+
+    // Serialize results to JSON.
+    nlohmann::json results_json;
+    for (unsigned int setting = 0; setting < setting_ct; ++setting) {
+      nlohmann::json setting_json;
+      for (auto result = ordered_results[reciter][setting].begin(); result != ordered_results[reciter][setting].end();
+           result++) {
+        setting_json.push_back(result_to_json(**result));
+      }
+      if (sweep.empty()) {
+        results_json = setting_json;
+      } else {
+        results_json.push_back({{"params", params_to_json(sweep[setting])}, {"results", setting_json}});
+      }
+    }
+    if (manifest) {
+      std::ofstream out_file(out_base + ".json");
+      out_file << results_json;
+      out_file.close();
+      if (!out_file) {
+        // Carry on with the rest - their results are no less good for it.
+        std::cerr << "Couldn't write " << out_base << ".json" << std::endl;
+        write_failed = true;
+      }
+    } else {
+      std::cout << results_json;
+    }
+    // After the JSON, so that's not lost if this goes wrong.
+    if (options.count("binary-out")) {
+      try {
+        write_timing_file(ordered_results[reciter][0], manifest ? out_base + ".bin" : options["binary-out"]);
+      } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        write_failed = true;
+      }
+    }
+  }
+  return write_failed ? 1 : 0;
 }
@@ -0,0 +1,46 @@
+#include "manifest.h"
+#include "corpus.h"
+#include <algorithm>
+#include <dirent.h>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+std::vector<Reciter> load_manifest(const std::string &path) {
+  std::ifstream manifest_file(path);
+  if (!manifest_file.good()) {
+    throw std::runtime_error("Couldn't open " + path);
+  }
+  std::vector<Reciter> reciters;
+  std::string line;
+  while (std::getline(manifest_file, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    std::istringstream fields(line);
+    Reciter reciter;
+    if (!(fields >> reciter.name >> reciter.ps_cfg >> reciter.audio_dir)) {
+      throw std::runtime_error("Malformed manifest line: " + line);
+    }
+    reciters.push_back(reciter);
+  }
+  return reciters;
+}
+
+std::vector<std::string> list_audio_files(const std::string &dir) {
+  std::vector<std::string> files;
+  DIR *dir_handle = opendir(dir.c_str());
+  if (!dir_handle) {
+    throw std::runtime_error("Couldn't open " + dir);
+  }
+  struct dirent *entry;
+  while ((entry = readdir(dir_handle))) {
+    unsigned short surah, ayah;
+    if (parse_audio_filename(entry->d_name, surah, ayah)) {
+      files.push_back(dir + "/" + entry->d_name);
+    }
+  }
+  closedir(dir_handle);
+  std::sort(files.begin(), files.end());
+  return files;
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include <string>
+#include <vector>
+
+// One line of a --manifest file: "name ps.cfg audio_dir", whitespace-separated. # starts a comment line.
+struct Reciter {
+  std::string name;
+  std::string ps_cfg;
+  std::string audio_dir;
+};
+
+std::vector<Reciter> load_manifest(const std::string &path);
+
+// All the ..._sssaaa.wav/.mp3 files in a directory, sorted.
+std::vector<std::string> list_audio_files(const std::string &dir);
@@ -0,0 +1,67 @@
+#include "merge.h"
+#include "result_stream.h"
+#include <fstream>
+#include <memory>
+#include <queue>
+#include <stdexcept>
+
+// Reads path through, throwing if it can't be merged - so a bad input's caught before any output is written.
+static void check_mergeable(const std::string &path) {
+  std::ifstream file(path);
+  if (!file.good()) {
+    throw std::runtime_error("Couldn't open " + path);
+  }
+  ResultStreamReader reader(file);
+  nlohmann::json result;
+  unsigned int last_key = 0;
+  while (reader.Next(result)) {
+    auto key = result_key(result);
+    if (key < last_key) {
+      throw std::runtime_error(path + " isn't in surah/ayah order");
+    }
+    last_key = key;
+  }
+}
+
+void merge_results(const std::vector<std::string> &paths, std::ostream &out) {
+  for (auto path = paths.begin(); path != paths.end(); path++) {
+    check_mergeable(*path);
+  }
+  std::vector<std::unique_ptr<std::ifstream>> files;
+  std::vector<std::unique_ptr<ResultStreamReader>> readers;
+  std::vector<nlohmann::json> heads(paths.size());
+  // (key, input index) - ties go to the earlier input.
+  typedef std::pair<unsigned int, size_t> HeapEntry;
+  std::priority_queue<HeapEntry, std::vector<HeapEntry>, std::greater<HeapEntry>> heap;
+  for (size_t i = 0; i < paths.size(); ++i) {
+    files.emplace_back(new std::ifstream(paths[i]));
+    if (!files.back()->good()) {
+      throw std::runtime_error("Couldn't open " + paths[i]);
+    }
+    readers.emplace_back(new ResultStreamReader(*files.back()));
+    if (readers[i]->Next(heads[i])) {
+      heap.push(std::make_pair(result_key(heads[i]), i));
+    }
+  }
+
+  bool first = true;
+  unsigned int last_key = 0;
+  out << "[";
+  while (!heap.empty()) {
+    auto entry = heap.top();
+    heap.pop();
+    if (first || entry.first != last_key) {
+      out << (first ? "" : ",") << heads[entry.second];
+      first = false;
+      last_key = entry.first;
+    }
+    if (readers[entry.second]->Next(heads[entry.second])) {
+      auto key = result_key(heads[entry.second]);
+      if (key < entry.first) {
+        throw std::runtime_error(paths[entry.second] + " isn't in surah/ayah order");
+      }
+      heap.push(std::make_pair(key, entry.second));
+    }
+  }
+  out << "]";
+}
@@ -0,0 +1,10 @@
+#pragma once
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Merges result files (e.g. from --shard runs) into one surah/ayah-ordered array on out.
+// Each input must already be in order, as align writes them. Where an ayah appears more than once, the copy from the
+// earliest-listed file wins. Inputs are checked before anything's written, throwing if they're unreadable or out of
+// order.
+void merge_results(const std::vector<std::string> &paths, std::ostream &out);
@@ -0,0 +1,89 @@
+#include "metrics.h"
+#include "debug.h"
+#include <cstdio>
+#include <fstream>
+
+static const char *PHASE_NAMES[] = {"load", "decode", "admit", "align"};
+
+void Metrics::JobFinished(unsigned int audio_msec, bool failed, unsigned int estimated_msec) {
+  _estimated_msec_done += estimated_msec;
+  if (failed) {
+    _jobs_failed++;
+  } else {
+    _jobs_done++;
+    _audio_msec += audio_msec;
+  }
+  _jobs_inflight--;
+  // Taking the lock, however briefly, means a waiter is either yet to check the counters or already waiting.
+  { std::lock_guard<std::mutex> lock(_progress_mtx); }
+  _progress_cv.notify_all();
+}
+
+void Metrics::AddPhaseTime(Phase phase, double secs) {
+  _phase_usec[(size_t)phase] += (uint64_t)(secs * 1e6);
+}
+
+size_t Metrics::WaitForProgress(size_t finished_seen, std::chrono::milliseconds timeout) {
+  std::unique_lock<std::mutex> lock(_progress_mtx);
+  _progress_cv.wait_for(lock, timeout, [&] { return _jobs_done + _jobs_failed > finished_seen; });
+  return _jobs_done + _jobs_failed;
+}
+
+void Metrics::Write(std::ostream &out) const {
+  out << "# HELP quranalign_jobs_queued Ayat queued for alignment.\n"
+      << "# TYPE quranalign_jobs_queued gauge\n"
+      << "quranalign_jobs_queued " << _jobs_total << "\n"
+      << "# HELP quranalign_jobs_done_total Ayat aligned.\n"
+      << "# TYPE quranalign_jobs_done_total counter\n"
+      << "quranalign_jobs_done_total " << _jobs_done << "\n"
+      << "# HELP quranalign_jobs_failed_total Ayat that couldn't be aligned at all.\n"
+      << "# TYPE quranalign_jobs_failed_total counter\n"
+      << "quranalign_jobs_failed_total " << _jobs_failed << "\n"
+      << "# HELP quranalign_jobs_inflight Ayat currently being worked on.\n"
+      << "# TYPE quranalign_jobs_inflight gauge\n"
+      << "quranalign_jobs_inflight " << _jobs_inflight << "\n"
+      << "# HELP quranalign_audio_seconds_total Length of the audio aligned.\n"
+      << "# TYPE quranalign_audio_seconds_total counter\n"
+      << "quranalign_audio_seconds_total " << AudioSecs() << "\n"
+      << "# HELP quranalign_phase_seconds_total Worker time spent in each phase of a job.\n"
+      << "# TYPE quranalign_phase_seconds_total counter\n";
+  for (size_t phase = 0; phase < (size_t)Phase::Count; ++phase) {
+    out << "quranalign_phase_seconds_total{phase=\"" << PHASE_NAMES[phase] << "\"} " << _phase_usec[phase] / 1e6
+        << "\n";
+  }
+}
+
+MetricsFileWriter::MetricsFileWriter(const Metrics &metrics, const std::string &path,
+                                     std::chrono::milliseconds interval)
+    : _metrics(metrics), _path(path), _interval(interval) {
+  _thread = std::thread([this] {
+    std::unique_lock<std::mutex> lock(_mtx);
+    while (!_stop) {
+      write();
+      _cv.wait_for(lock, _interval, [&] { return _stop; });
+    }
+  });
+}
+
+MetricsFileWriter::~MetricsFileWriter() {
+  {
+    std::lock_guard<std::mutex> lock(_mtx);
+    _stop = true;
+  }
+  _cv.notify_all();
+  _thread.join();
+  write();
+}
+
+void MetricsFileWriter::write() {
+  std::string tmp_path = _path + ".tmp";
+  {
+    std::ofstream out(tmp_path);
+    _metrics.Write(out);
+    if (!out) {
+      DEBUG("Couldn't write " << tmp_path);
+      return;
+    }
+  }
+  rename(tmp_path.c_str(), _path.c_str());
+}
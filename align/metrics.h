@@ -0,0 +1,70 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+
+// Where a job's wall time goes. Load is building a worker's decoder, Admit is waiting on the memory budget.
+enum class Phase { Load, Decode, Admit, Align, Count };
+
+// Counters the workers bump as they go, cheap enough to do per job without contending on a lock. Anyone interested in
+// progress can block in WaitForProgress rather than polling.
+class Metrics {
+public:
+  void SetJobsTotal(size_t jobs) { _jobs_total = jobs; }
+  // Audio queued, by up-front estimates - job_audio_msec before decoding, which for MP3s is only proportional to their
+  // length. Progress in the same terms comes from JobFinished's estimated_msec.
+  void SetEstimatedAudioTotal(uint64_t estimated_msec) { _estimated_msec_total = estimated_msec; }
+  void JobStarted() { _jobs_inflight++; }
+  void JobFinished(unsigned int audio_msec, bool failed, unsigned int estimated_msec = 0);
+  void AddPhaseTime(Phase phase, double secs);
+
+  size_t JobsTotal() const { return _jobs_total; }
+  size_t JobsDone() const { return _jobs_done; }
+  size_t JobsFailed() const { return _jobs_failed; }
+  size_t JobsInflight() const { return _jobs_inflight; }
+  double AudioSecs() const { return _audio_msec / 1000.0; }
+  // Fraction of the estimated audio that's finished, successfully or not.
+  double EstimatedAudioFraction() const {
+    return _estimated_msec_total ? (double)_estimated_msec_done / _estimated_msec_total : 0;
+  }
+
+  // Blocks until more than finished_seen jobs have finished (successfully or not), or the timeout passes. Returns the
+  // number finished.
+  size_t WaitForProgress(size_t finished_seen, std::chrono::milliseconds timeout);
+
+  // Prometheus text exposition format.
+  void Write(std::ostream &out) const;
+
+private:
+  std::atomic<size_t> _jobs_total{0}, _jobs_done{0}, _jobs_failed{0}, _jobs_inflight{0};
+  std::atomic<uint64_t> _audio_msec{0}, _estimated_msec_total{0}, _estimated_msec_done{0};
+  std::atomic<uint64_t> _phase_usec[(size_t)Phase::Count] = {};
+  // Only so WaitForProgress can't miss a wakeup - the counters themselves never need it.
+  std::mutex _progress_mtx;
+  std::condition_variable _progress_cv;
+};
+
+// Rewrites path with a snapshot of metrics every interval until destroyed, for node_exporter's textfile collector or
+// anything else that can scrape a file. Each write lands via rename, so readers never see half a file.
+class MetricsFileWriter {
+public:
+  MetricsFileWriter(const Metrics &metrics, const std::string &path,
+                    std::chrono::milliseconds interval = std::chrono::milliseconds(1000));
+  // Writes a final snapshot.
+  ~MetricsFileWriter();
+
+private:
+  void write();
+  const Metrics &_metrics;
+  std::string _path;
+  std::chrono::milliseconds _interval;
+  bool _stop = false;
+  std::mutex _mtx;
+  std::condition_variable _cv;
+  std::thread _thread;
+};
@@ -1,17 +1,38 @@
 #include "mmap.h"
+#include <cerrno>
 #include <cstdio>
+#include <cstring>
 #include <fcntl.h>
+#include <stdexcept>
 #include <sys/mman.h>
 #include <sys/stat.h>
 
+static std::runtime_error file_error(const std::string &what, const std::string &filename) {
+  return std::runtime_error(what + " " + filename + ": " + strerror(errno));
+}
+
 MMapFile::MMapFile(const std::string &filename) {
+  _fd = open(filename.c_str(), O_RDONLY, 0);
+  if (_fd < 0) {
+    throw file_error("Couldn't open", filename);
+  }
   struct stat st;
-  stat(filename.c_str(), &st);
+  if (fstat(_fd, &st) != 0) {
+    close(_fd);
+    throw file_error("Couldn't stat", filename);
+  }
   _size = st.st_size;
-  _fd = open(filename.c_str(), O_RDONLY, 0);
+  if (!_size) {
+    // mmap won't do zero-length maps.
+    close(_fd);
+    throw std::runtime_error("Empty file " + filename);
+  }
   static const int mmap_flags = MAP_PRIVATE | MAP_POPULATE;
   _data = mmap(NULL, _size, PROT_READ, mmap_flags, _fd, 0);
-  // Hope the memory-map op didn't fail.
+  if (_data == MAP_FAILED) {
+    close(_fd);
+    throw file_error("Couldn't map", filename);
+  }
 }
 
 MMapFile::~MMapFile() {
@@ -0,0 +1,111 @@
+#include "params.h"
+#include "rates.h"
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+// Checks for values that'd break things, returning what's wrong with the value or NULL if it's fine.
+static const char *not_negative(double value) {
+  return value < 0 ? "can't be negative" : NULL;
+}
+
+static const char *window_msec(double value) {
+  // Anything less would round down to an empty window, which the detectors would never step past.
+  return value < 1 ? "must be at least 1 msec" : NULL;
+}
+
+static const char *decay_factor(double value) {
+  return value > 0 && value < 1 ? NULL : "must be between 0 and 1, exclusive";
+}
+
+// Table entry for a param that's just its member, as is.
+#define PARAM(name, member, check)                                                                                     \
+  {#name, [](SegmentationParams &params, double value) { params.member = value; },                                     \
+   [](const SegmentationParams &params) { return (double)params.member; }, check}
+
+static const struct {
+  const char *name;
+  void (*set)(SegmentationParams &params, double value);
+  double (*get)(const SegmentationParams &params);
+  const char *(*check)(double value); // NULL if anything goes.
+} PARAMS[] = {
+    PARAM(power_silence_start, discriminator.power_silence_start, NULL),
+    PARAM(power_silence_end, discriminator.power_silence_end, NULL),
+    {"power_window",
+     [](SegmentationParams &params, double value) { params.discriminator.power_window = MSEC2WAVF((size_t)value); },
+     [](const SegmentationParams &params) { return (double)WAVF2MSEC(params.discriminator.power_window); },
+     window_msec},
+    PARAM(power_a_mean, discriminator.power_a_mean, decay_factor),
+    PARAM(power_a_var, discriminator.power_a_var, decay_factor),
+    PARAM(power_thresh_sigma, discriminator.power_thresh_sigma, NULL),
+    PARAM(mfcc_a_mean, discriminator.mfcc_a_mean, decay_factor),
+    PARAM(mfcc_a_var, discriminator.mfcc_a_var, decay_factor),
+    PARAM(mfcc_thresh_sigma, discriminator.mfcc_thresh_sigma, NULL),
+    PARAM(max_backtrack, max_backtrack, not_negative),
+    PARAM(min_word_len, min_word_len, not_negative),
+};
+
+std::vector<SegmentationParams> load_param_grid(const std::string &path) {
+  std::ifstream params_file(path);
+  if (!params_file.good()) {
+    throw std::runtime_error("Couldn't open " + path);
+  }
+  std::vector<SegmentationParams> grid(1);
+  std::string line;
+  while (std::getline(params_file, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    std::istringstream fields(line);
+    std::string name;
+    std::vector<double> values;
+    double value;
+    fields >> name;
+    while (fields >> value) {
+      values.push_back(value);
+    }
+    if (values.empty() || !fields.eof()) {
+      throw std::runtime_error("Malformed params line: " + line);
+    }
+    auto param = std::begin(PARAMS);
+    while (param != std::end(PARAMS) && name != param->name) {
+      param++;
+    }
+    if (param == std::end(PARAMS)) {
+      throw std::runtime_error("Unknown param " + name);
+    }
+    for (auto value = values.begin(); param->check && value != values.end(); value++) {
+      if (auto problem = param->check(*value)) {
+        throw std::runtime_error("Bad params line: " + line + " (" + name + " " + problem + ")");
+      }
+    }
+
+    std::vector<SegmentationParams> expanded;
+    for (auto params = grid.begin(); params != grid.end(); params++) {
+      for (auto value = values.begin(); value != values.end(); value++) {
+        expanded.push_back(*params);
+        param->set(expanded.back(), *value);
+      }
+    }
+    grid.swap(expanded);
+  }
+  return grid;
+}
+
+SegmentationParams load_params(const std::string &path) {
+  auto grid = load_param_grid(path);
+  if (grid.size() != 1) {
+    throw std::runtime_error(path + " has more than one value for a param - sweep it instead?");
+  }
+  return grid.front();
+}
+
+nlohmann::json params_to_json(const SegmentationParams &params) {
+  nlohmann::json params_json;
+  for (auto param = std::begin(PARAMS); param != std::end(PARAMS); param++) {
+    // Most are floats, so round off the noise they'd pick up as doubles.
+    params_json[param->name] = std::round(param->get(params) * 1e6) / 1e6;
+  }
+  return params_json;
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include "segment.h"
+#include "vendor/json.hpp"
+#include <string>
+#include <vector>
+
+// A --params file is lines of "name value", whitespace-separated, overriding the SegmentationParams defaults. Names are
+// the member names, without the discriminator. prefix - e.g. power_thresh_sigma, max_backtrack - and power_window is
+// in msec. # starts a comment line. Values that can't work - a window under 1 msec, a decay factor outside (0, 1),
+// a negative length - are rejected.
+SegmentationParams load_params(const std::string &path);
+
+// A --sweep file is the same, but each name can be followed by several values. Returns every combination of them, the
+// last name's values varying fastest.
+std::vector<SegmentationParams> load_param_grid(const std::string &path);
+
+// All the settings in params, by the names above.
+nlohmann::json params_to_json(const SegmentationParams &params);
@@ -0,0 +1,188 @@
+#include "pipeline.h"
+#include "debug.h"
+#include <chrono>
+#include <memory>
+
+TierStats &TierStats::operator+=(const TierStats &other) {
+  fast_ct += other.fast_ct;
+  full_ct += other.full_ct;
+  retry_ct += other.retry_ct;
+  retry_improved_ct += other.retry_improved_ct;
+  timeout_ct += other.timeout_ct;
+  fallback_ct += other.fallback_ct;
+  fast_secs += other.fast_secs;
+  full_secs += other.full_secs;
+  return *this;
+}
+
+static size_t count_unmatched_words(const SegmentationResult &result) {
+  size_t exact_words = 0;
+  for (auto span = result.spans.begin(); span != result.spans.end(); span++) {
+    if (span->flags & SpanFlag::Exact) {
+      exact_words += span->index_end - span->index_start;
+    }
+  }
+  return result.job.in_words.size() - exact_words;
+}
+
+static size_t count_errors(const SegmentationResult &result) {
+  return result.stats.insertions + result.stats.deletions + result.stats.transpositions;
+}
+
+static bool needs_full_decode(const SegmentationResult &result, const TierConfig &tiers) {
+  return count_errors(result) > tiers.max_errors || count_unmatched_words(result) > tiers.max_unmatched;
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point since) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count();
+}
+
+static void collapse_muqataat(SegmentationResult &result) {
+  // Muqata'at are represented in the recognition model as discrete words.
+  // This has turned out to be an inconvenient decision, regardless of its merits.
+  // We collapse them back into a single word here, triggered by the fact they are
+  // of form  __...__ in the reference text.
+  std::vector<SegmentedWordSpan> original_spans;
+  original_spans.swap(result.spans);
+  int collapsed_muqataat = 0;
+  for (auto span = original_spans.begin(); span != original_spans.end(); span++) {
+    if ((collapsed_muqataat && result.job.in_words[span->index_start].size() == 0) ||
+        result.job.in_words[span->index_start][0] == '_') {
+      if (!collapsed_muqataat) {
+        span->index_end = 1;
+        result.spans.push_back(*span);
+      }
+      result.spans.back().end = span->end;
+      collapsed_muqataat++;
+    } else {
+      if (collapsed_muqataat) {
+        span->index_start -= collapsed_muqataat - 1;
+        span->index_end -= collapsed_muqataat - 1;
+      }
+      result.spans.push_back(*span);
+    }
+  }
+}
+
+
+// Runs one decode attempt into recognition. Returns false, leaving recognition alone, if it overran its budget.
+static bool timed_run(SegmentationProcessor &seg_proc, const SegmentationJob &job, DecodeTier tier,
+                      double budget_secs, std::unique_ptr<Recognition> &recognition, TierStats &tier_stats) {
+  auto decode_start = std::chrono::steady_clock::now();
+  auto deadline = std::chrono::steady_clock::time_point::max();
+  if (budget_secs > 0) {
+    deadline = decode_start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                  std::chrono::duration<double>(budget_secs));
+  }
+  bool finished = true;
+  try {
+    recognition = seg_proc.Recognize(job, tier, deadline);
+  } catch (const SegmentationTimeout &) {
+    DEBUG("Timed out decoding " << job.in_file << " after " << budget_secs << "s");
+    tier_stats.timeout_ct++;
+    finished = false;
+  }
+  if (tier == DecodeTier::Fast) {
+    tier_stats.fast_ct++;
+    tier_stats.fast_secs += seconds_since(decode_start);
+  } else {
+    tier_stats.full_ct++;
+    tier_stats.full_secs += seconds_since(decode_start);
+  }
+  return finished;
+}
+
+// Decodes the job through the tiers. Returns null if every attempt overran its budget.
+static std::unique_ptr<Recognition> recognize_job(SegmentationProcessor &seg_proc, const SegmentationJob &job,
+                                                  const TierConfig &tiers, TierStats &tier_stats) {
+  double budget_secs = 0;
+  if (tiers.budget_factor > 0) {
+    budget_secs = tiers.budget_base_secs + tiers.budget_factor * job_audio_msec(job) / 1000;
+  }
+  std::unique_ptr<Recognition> recognition;
+  if (tiers.fast_pass) {
+    if (timed_run(seg_proc, job, DecodeTier::Fast, budget_secs, recognition, tier_stats)) {
+      auto fast_result = refine_recognition(*recognition, seg_proc.Params());
+      if (needs_full_decode(fast_result, tiers)) {
+        DEBUG("Retrying " << job.in_file << " at full beam");
+        tier_stats.retry_ct++;
+        // If this one overruns or fails we've still got the fast pass's recognition.
+        std::unique_ptr<Recognition> full_recognition;
+        try {
+          if (timed_run(seg_proc, job, DecodeTier::Full, budget_secs, full_recognition, tier_stats)) {
+            auto full_result = refine_recognition(*full_recognition, seg_proc.Params());
+            size_t fast_misses = count_errors(fast_result) + count_unmatched_words(fast_result);
+            size_t full_misses = count_errors(full_result) + count_unmatched_words(full_result);
+            // Kept so --retry-errors/--retry-unmatched can be tuned against what retrying actually buys.
+            if (full_misses < fast_misses) {
+              tier_stats.retry_improved_ct++;
+            }
+            // The full beam does occasionally come out worse - then the fast pass's take stands.
+            if (full_misses <= fast_misses) {
+              recognition.swap(full_recognition);
+            }
+          }
+        } catch (const std::exception &e) {
+          DEBUG("Full beam retry of " << job.in_file << " failed, keeping the fast pass: " << e.what());
+        }
+      }
+    }
+  } else {
+    if (!timed_run(seg_proc, job, DecodeTier::Full, budget_secs, recognition, tier_stats)) {
+      timed_run(seg_proc, job, DecodeTier::Fast, budget_secs, recognition, tier_stats);
+    }
+  }
+  if (!recognition) {
+    tier_stats.fallback_ct++;
+  }
+  return recognition;
+}
+
+// Turns a recognition (or lack thereof) into the result we output.
+static SegmentationResult finish_result(const SegmentationJob &job, const Recognition *recognition,
+                                        const SegmentationParams &params) {
+  SegmentationResult result = recognition ? refine_recognition(*recognition, params) : even_split(job, params);
+  collapse_muqataat(result);
+  if (job.in_words.size() != result.spans.size()) {
+    DEBUG("Mismatched word count! Ref " << job.in_words.size() << " matched " << result.spans.size() << " spans");
+    for (auto i = result.spans.begin(); i != result.spans.end(); i++) {
+      DEBUG(i->start << "~" << i->end << " words " << i->index_start << "~" << i->index_end);
+    }
+  }
+  return result;
+}
+
+SegmentationResult process_job(SegmentationProcessor &seg_proc, const SegmentationJob &job, const TierConfig &tiers,
+                               TierStats &tier_stats) {
+  auto recognition = recognize_job(seg_proc, job, tiers, tier_stats);
+  return finish_result(job, recognition.get(), seg_proc.Params());
+}
+
+std::vector<SegmentationResult> process_job_sweep(SegmentationProcessor &seg_proc, const SegmentationJob &job,
+                                                  const TierConfig &tiers,
+                                                  const std::vector<SegmentationParams> &grid,
+                                                  TierStats &tier_stats) {
+  auto recognition = recognize_job(seg_proc, job, tiers, tier_stats);
+  std::vector<SegmentationResult> results;
+  for (auto params = grid.begin(); params != grid.end(); params++) {
+    results.push_back(finish_result(job, recognition.get(), *params));
+  }
+  return results;
+}
+
+nlohmann::json result_to_json(const SegmentationResult &result) {
+  nlohmann::json result_json;
+  result_json["surah"] = result.job.surah;
+  result_json["ayah"] = result.job.ayah;
+  result_json["stats"] = nlohmann::json();
+  result_json["stats"]["insertions"] = result.stats.insertions;
+  result_json["stats"]["deletions"] = result.stats.deletions;
+  result_json["stats"]["transpositions"] = result.stats.transpositions;
+  if (result.fallback) {
+    result_json["fallback"] = true;
+  }
+  for (auto span = result.spans.begin(); span != result.spans.end(); span++) {
+    result_json["segments"].push_back({span->index_start, span->index_end, span->start, span->end});
+  }
+  return result_json;
+}
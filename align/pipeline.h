@@ -0,0 +1,36 @@
+#pragma once
+#include "segment.h"
+#include "vendor/json.hpp"
+
+// When to give up on the fast decoding tier and rerun an ayah with the full beam.
+struct TierConfig {
+  bool fast_pass = true;
+  // A full decode leaves the odd word inexact too (see README), so one slip on its own isn't worth paying for another.
+  size_t max_errors = 1;    // Insertions + deletions + transpositions.
+  size_t max_unmatched = 1; // Reference words without an exact match.
+  // Each decode attempt gets budget_base_secs + budget_factor * audio length before it's abandoned. 0 disables.
+  double budget_factor = 5;
+  double budget_base_secs = 10;
+};
+
+struct TierStats {
+  unsigned int fast_ct = 0, full_ct = 0, retry_ct = 0, timeout_ct = 0, fallback_ct = 0;
+  unsigned int retry_improved_ct = 0; // Retries that came back with fewer errors + inexact words than the fast pass.
+  double fast_secs = 0, full_secs = 0;
+  TierStats &operator+=(const TierStats &other);
+};
+
+// Runs a job through the decoding tiers and tidies the result up for output.
+// Attempts that overrun their budget are retried with cheaper settings, and failing that we fall back to even_split.
+SegmentationResult process_job(SegmentationProcessor &seg_proc, const SegmentationJob &job, const TierConfig &tiers,
+                               TierStats &tier_stats);
+
+// process_job, but refining the recognition with each of grid in turn instead of the processor's own params - so the
+// decoding's only done once, however big the grid. Results are in grid order.
+std::vector<SegmentationResult> process_job_sweep(SegmentationProcessor &seg_proc, const SegmentationJob &job,
+                                                  const TierConfig &tiers,
+                                                  const std::vector<SegmentationParams> &grid,
+                                                  TierStats &tier_stats);
+
+// One member of the output array - see README for the format.
+nlohmann::json result_to_json(const SegmentationResult &result);
@@ -0,0 +1,50 @@
+#include "prefetch.h"
+#include "debug.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+AudioPrefetcher::AudioPrefetcher(const std::vector<std::string> &paths, size_t depth) : _paths(paths), _depth(depth) {
+  if (_depth) {
+    _thread = std::thread([this] { run(); });
+  }
+}
+
+AudioPrefetcher::~AudioPrefetcher() {
+  {
+    std::lock_guard<std::mutex> lock(_mtx);
+    _stop = true;
+  }
+  _cv.notify_all();
+  if (_thread.joinable()) {
+    _thread.join();
+  }
+}
+
+void AudioPrefetcher::Advance() {
+  {
+    std::lock_guard<std::mutex> lock(_mtx);
+    _taken++;
+  }
+  _cv.notify_all();
+}
+
+void AudioPrefetcher::run() {
+  for (size_t next = 0; next < _paths.size(); ++next) {
+    {
+      std::unique_lock<std::mutex> lock(_mtx);
+      _cv.wait(lock, [&] { return _stop || next < _taken + _depth; });
+      if (_stop) {
+        return;
+      }
+    }
+    // WILLNEED kicks off readahead of the whole file and returns without waiting for it.
+    int fd = open(_paths[next].c_str(), O_RDONLY);
+    if (fd < 0) {
+      // The worker will hit (and report) this soon enough.
+      continue;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+    DEBUG("Prefetch " << _paths[next]);
+  }
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Asks the kernel to start reading files in before the workers get to them, so decoding a cold directory isn't stuck
+// waiting on the disk. Stays at most depth files ahead of the workers, so the page cache isn't flooded.
+class AudioPrefetcher {
+public:
+  // paths must be in the order the workers will take them.
+  AudioPrefetcher(const std::vector<std::string> &paths, size_t depth);
+  ~AudioPrefetcher();
+  // Call as each file is taken by a worker.
+  void Advance();
+
+private:
+  void run();
+  const std::vector<std::string> &_paths;
+  size_t _depth;
+  size_t _taken = 0;
+  bool _stop = false;
+  std::mutex _mtx;
+  std::condition_variable _cv;
+  std::thread _thread;
+};
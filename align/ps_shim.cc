@@ -1,4 +1,8 @@
 #include "ps_shim.h"
+#include "ngram_search.h"
+#include "ngram_search_fwdflat.h"
+#include "ngram_search_fwdtree.h"
+#include <sstream>
 
 // Shamelessly copy-pasted from pocketsphinx source code...
 mfcc_t **acmod_shim_calculate_mfcc(acmod_t *acmod, int16 const *audio_data, size_t *inout_n_samps) {
@@ -29,3 +33,184 @@ mfcc_t **acmod_shim_calculate_mfcc(acmod_t *acmod, int16 const *audio_data, size
   acmod->fe->transform = old_xform;
   return acmod->mfc_buf;
 }
+
+// ...and again - ps_search_forward, with a clock check between frames.
+static int shim_search_forward(ps_decoder_t *ps, std::chrono::steady_clock::time_point deadline) {
+  int nfr = 0;
+  while (ps->acmod->n_feat_frame > 0) {
+    int k;
+    if (std::chrono::steady_clock::now() > deadline) {
+      return PS_SHIM_TIMEOUT;
+    }
+    if (ps->pl_window > 0) {
+      if ((k = ps_search_step(ps->phone_loop, ps->acmod->output_frame)) < 0) {
+        return k;
+      }
+    }
+    if (ps->acmod->output_frame >= ps->pl_window) {
+      if ((k = ps_search_step(ps->search, ps->acmod->output_frame - ps->pl_window)) < 0) {
+        return k;
+      }
+    }
+    acmod_advance(ps->acmod);
+    ++ps->n_frame;
+    ++nfr;
+  }
+  return nfr;
+}
+
+int ps_shim_process_raw(ps_decoder_t *ps, int16 const *data, size_t n_samples, int full_utt,
+                        std::chrono::steady_clock::time_point deadline) {
+  int n_searchfr = 0;
+  if (ps->acmod->state == ACMOD_IDLE) {
+    return -1;
+  }
+  while (n_samples) {
+    int nfr;
+    if ((nfr = acmod_process_raw(ps->acmod, &data, &n_samples, full_utt)) < 0) {
+      return nfr;
+    }
+    if ((nfr = shim_search_forward(ps, deadline)) < 0) {
+      return nfr;
+    }
+    n_searchfr += nfr;
+  }
+  return n_searchfr;
+}
+
+// ...and ngram_search_finish, checking the clock between frames of the fwdflat pass.
+static int shim_ngram_search_finish(ngram_search_t *ngs, std::chrono::steady_clock::time_point deadline) {
+  ngs->n_tot_frame += ngs->n_frame;
+  if (ngs->fwdtree) {
+    ngram_fwdtree_finish(ngs);
+    if (ngs->fwdflat) {
+      acmod_t *acmod = ps_search_acmod(ngs);
+      if (acmod_rewind(acmod) < 0) {
+        return -1;
+      }
+      ngram_fwdflat_start(ngs);
+      for (int i = 0; acmod->n_feat_frame > 0; ++i) {
+        int nfr;
+        if (std::chrono::steady_clock::now() > deadline) {
+          return PS_SHIM_TIMEOUT;
+        }
+        if ((nfr = ngram_fwdflat_search(ngs, i)) < 0) {
+          return nfr;
+        }
+        acmod_advance(acmod);
+      }
+      ngram_fwdflat_finish(ngs);
+    }
+  } else if (ngs->fwdflat) {
+    ngram_fwdflat_finish(ngs);
+  }
+  ngs->done = TRUE;
+  return 0;
+}
+
+// ...and ps_end_utt, finishing n-gram searches with the above.
+int ps_shim_end_utt(ps_decoder_t *ps, std::chrono::steady_clock::time_point deadline) {
+  int rv;
+  if (ps->acmod->state == ACMOD_ENDED || ps->acmod->state == ACMOD_IDLE) {
+    return -1;
+  }
+  acmod_end_utt(ps->acmod);
+  if ((rv = shim_search_forward(ps, deadline)) < 0) {
+    return rv;
+  }
+  if (ps->phone_loop && (rv = ps_search_finish(ps->phone_loop)) < 0) {
+    return rv;
+  }
+  // Frames left in the phone loop's lookahead window.
+  if (ps->acmod->output_frame >= ps->pl_window) {
+    for (int i = ps->acmod->output_frame - ps->pl_window; i < ps->acmod->output_frame; ++i) {
+      ps_search_step(ps->search, i);
+    }
+  }
+  if (strcmp(ps_search_type(ps->search), PS_SEARCH_TYPE_NGRAM) == 0) {
+    rv = shim_ngram_search_finish((ngram_search_t *)ps->search, deadline);
+  } else {
+    rv = ps_search_finish(ps->search);
+  }
+  ptmr_stop(&ps->perf);
+  return rv;
+}
+
+void ps_shim_skip_bestpath(ps_decoder_t *ps) {
+  if (strcmp(ps_search_type(ps->search), PS_SEARCH_TYPE_NGRAM) == 0) {
+    ((ngram_search_t *)ps->search)->bestpath = FALSE;
+  }
+}
+
+void ps_shim_abandon_utt(ps_decoder_t *ps) {
+  if (ps->acmod->state == ACMOD_STARTED || ps->acmod->state == ACMOD_PROCESSING) {
+    acmod_end_utt(ps->acmod);
+  }
+}
+
+// ...and ps_load_dict, dict_init-ing from words we've already got rather than a file.
+int ps_shim_set_words(ps_decoder_t *ps, const std::vector<std::pair<std::string, std::string>> &words, bool fwdflat) {
+  // No -dict, so this is just the fillers. dict_init reads them from _fdict, which ps_expand_model_config filled in
+  // from -fdict or the model's noisedict.
+  cmd_ln_t *dict_config = cmd_ln_init(NULL, ps_args(), TRUE, NULL);
+  cmd_ln_set_boolean_r(dict_config, "-dictcase", cmd_ln_boolean_r(ps->config, "-dictcase"));
+  cmd_ln_set_str_extra_r(dict_config, "_fdict", cmd_ln_str_r(ps->config, "_fdict"));
+  dict_t *dict = dict_init(dict_config, ps->acmod->mdef);
+  cmd_ln_free_r(dict_config);
+  if (!dict) {
+    return -1;
+  }
+  std::vector<s3cipid_t> pron;
+  for (auto word = words.begin(); word != words.end(); word++) {
+    pron.clear();
+    std::istringstream phones(word->second);
+    std::string phone;
+    while (phones >> phone) {
+      int ciphone = bin_mdef_ciphone_id(ps->acmod->mdef, phone.c_str());
+      if (ciphone < 0) {
+        E_ERROR("Unknown phone %s in phone string %s\n", phone.c_str(), word->second.c_str());
+        dict_free(dict);
+        return -1;
+      }
+      pron.push_back(ciphone);
+    }
+    // As dict_read does with pronunciation-less lines.
+    if (pron.empty()) {
+      continue;
+    }
+    if (dict_add_word(dict, word->first.c_str(), pron.data(), pron.size()) == BAD_S3WID) {
+      dict_free(dict);
+      return -1;
+    }
+  }
+
+  dict2pid_t *d2p = dict2pid_build(ps->acmod->mdef, dict);
+  if (!d2p) {
+    dict_free(dict);
+    return -1;
+  }
+  dict_free(ps->dict);
+  ps->dict = dict;
+  dict2pid_free(ps->d2p);
+  ps->d2p = d2p;
+
+  for (hash_iter_t *search_it = hash_table_iter(ps->searches); search_it;
+       search_it = hash_table_iter_next(search_it)) {
+    ps_search_t *search = (ps_search_t *)hash_entry_val(search_it->ent);
+    bool ngram = strcmp(ps_search_type(search), PS_SEARCH_TYPE_NGRAM) == 0;
+    if (ngram) {
+      // ngram_search_reinit only rebuilds the fwdflat lexicon if the pass is on - so put it back how it was
+      // initialized, or a stale one would be left for when it's next switched on.
+      ((ngram_search_t *)search)->fwdflat = cmd_ln_boolean_r(ps->config, "-fwdflat");
+    }
+    if (ps_search_reinit(search, dict, d2p) < 0) {
+      hash_table_iter_free(search_it);
+      return -1;
+    }
+    if (ngram) {
+      ((ngram_search_t *)search)->fwdflat &= fwdflat;
+      ((ngram_search_t *)search)->bestpath = cmd_ln_boolean_r(ps->config, "-bestpath");
+    }
+  }
+  return 0;
+}
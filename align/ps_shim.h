@@ -4,5 +4,29 @@
 #include "pocketsphinx_internal.h"
 // WE NOW RETURN TO REGULARLY SCHEDULED PROGRAMMING
 #include "pocketsphinx.h"
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
 
 mfcc_t **acmod_shim_calculate_mfcc(acmod_t *acmod, int16 const *audio_data, size_t *inout_n_samps);
+
+// Returned by ps_shim_process_raw and ps_shim_end_utt when they run past their deadline.
+const int PS_SHIM_TIMEOUT = -2;
+// ps_process_raw, but giving up (mid-utterance - so ps_shim_abandon_utt it) once deadline passes.
+int ps_shim_process_raw(ps_decoder_t *ps, int16 const *data, size_t n_samples, int full_utt,
+                        std::chrono::steady_clock::time_point deadline);
+// ps_end_utt, with the same deadline - which also covers the fwdflat pass it'd otherwise run over the whole utterance.
+// On timeout the utterance is left ended, but without a result.
+int ps_shim_end_utt(ps_decoder_t *ps, std::chrono::steady_clock::time_point deadline);
+// Drops the bestpath pass, which otherwise runs unbounded when the result is first read, for this utterance only.
+void ps_shim_skip_bestpath(ps_decoder_t *ps);
+// Ends an utterance that's being given up on, without running any of the end-of-utterance passes. The searches are
+// left as they were - ps_shim_set_words resets them before the next.
+void ps_shim_abandon_utt(ps_decoder_t *ps);
+
+// ps_load_dict, but taking (word, phones) pairs from memory instead of a file - on top of the acoustic model's filler
+// words. Every search is reinitialized for the new dictionary, which also picks up any beams changed in the decoder's
+// config since, puts back a skipped bestpath, and throws away whatever an abandoned utterance left in them. fwdflat
+// switches the flat-lexicon rescoring pass off or (if the decoder was initialized with it) back on.
+int ps_shim_set_words(ps_decoder_t *ps, const std::vector<std::pair<std::string, std::string>> &words, bool fwdflat);
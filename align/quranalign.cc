@@ -0,0 +1,86 @@
+#include "quranalign.h"
+#include "err.h"
+#include "pipeline.h"
+#include "segment.h"
+#include <memory>
+#include <string>
+
+struct qa_processor {
+  std::unique_ptr<SegmentationProcessor> seg_proc;
+  TierConfig tiers;
+  TierStats tier_stats;
+  std::string last_error;
+};
+
+qa_processor_t *qa_processor_new(const char *ps_cfg_path, int fast_pass, int quiet) {
+  if (!ps_cfg_path) {
+    return NULL;
+  }
+  if (quiet) {
+    err_set_logfp(NULL);
+    err_set_debug_level(0);
+  }
+  std::unique_ptr<qa_processor_t> proc(new qa_processor_t);
+  try {
+    proc->seg_proc.reset(new SegmentationProcessor(ps_cfg_path));
+  } catch (const std::exception &) {
+    return NULL;
+  }
+  proc->tiers.fast_pass = fast_pass;
+  return proc.release();
+}
+
+void qa_processor_free(qa_processor_t *proc) { delete proc; }
+
+int qa_align(qa_processor_t *proc, const int16_t *pcm, size_t n_samples, const char *const *words, size_t n_words,
+             const qa_liaise_point_t *liaise_points, size_t n_liaise_points, qa_span_cb on_span, void *user_data,
+             qa_stats_t *stats) {
+  if (!proc) {
+    return -1;
+  }
+  proc->last_error.clear();
+  if (!on_span) {
+    proc->last_error = "No on_span callback";
+    return -1;
+  }
+  if (!pcm || !n_samples) {
+    proc->last_error = "No audio";
+    return -1;
+  }
+  if (!words || !n_words) {
+    proc->last_error = "No reference words";
+    return -1;
+  }
+  for (size_t i = 0; i < n_words; ++i) {
+    if (!words[i]) {
+      proc->last_error = "Reference word " + std::to_string(i) + " is NULL";
+      return -1;
+    }
+  }
+  if (n_liaise_points && !liaise_points) {
+    proc->last_error = "n_liaise_points is set but liaise_points is NULL";
+    return -1;
+  }
+  SegmentationJob job = {0, 0, "", std::vector<std::string>(words, words + n_words), {}, pcm, n_samples};
+  for (size_t i = 0; i < n_liaise_points; ++i) {
+    job.liaise_points.push_back({liaise_points[i].index, (LiaiseFlags)liaise_points[i].flags});
+  }
+  try {
+    auto result = process_job(*proc->seg_proc, job, proc->tiers, proc->tier_stats);
+    for (auto span = result.spans.begin(); span != result.spans.end(); span++) {
+      qa_span_t out_span = {span->index_start, span->index_end, span->start, span->end};
+      on_span(&out_span, user_data);
+    }
+    if (stats) {
+      stats->insertions = result.stats.insertions;
+      stats->deletions = result.stats.deletions;
+      stats->transpositions = result.stats.transpositions;
+    }
+  } catch (const std::exception &e) {
+    proc->last_error = e.what();
+    return -1;
+  }
+  return 0;
+}
+
+const char *qa_last_error(qa_processor_t *proc) { return proc->last_error.c_str(); }
@@ -0,0 +1,48 @@
+#pragma once
+// C interface to the aligner, for linking against libquranalign rather than shelling out to `align`.
+// Processors are independent of one another, so run one per thread - but don't share a processor between threads.
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct qa_processor qa_processor_t;
+
+typedef struct {
+  uint16_t index; // Word index within the ayah.
+  uint16_t flags; // As in quran.liaise.txt.
+} qa_liaise_point_t;
+
+// Mirrors SegmentedWordSpan - see README for the meaning of each field.
+typedef struct {
+  unsigned int index_start, index_end;
+  unsigned int start_msec, end_msec;
+} qa_span_t;
+
+typedef struct {
+  size_t insertions, deletions, transpositions;
+} qa_stats_t;
+
+typedef void (*qa_span_cb)(const qa_span_t *span, void *user_data);
+
+// ps_cfg_path is the same config file `align` takes. fast_pass enables the pruned first decoding tier.
+// Nonzero quiet turns pocketsphinx's logging off - for the whole process, since that's the only way sphinxbase has.
+// Returns NULL if ps_cfg_path is NULL or the config couldn't be loaded.
+qa_processor_t *qa_processor_new(const char *ps_cfg_path, int fast_pass, int quiet);
+void qa_processor_free(qa_processor_t *proc);
+
+// Aligns 16kHz mono samples against the reference words of one ayah, calling on_span for each segment in order before
+// returning. The samples are read in place. stats may be NULL, on_span may not, and there must be at least one sample
+// and one word. Returns 0 on success, or -1 with the reason available from qa_last_error (-1 alone if proc is NULL).
+int qa_align(qa_processor_t *proc, const int16_t *pcm, size_t n_samples, const char *const *words, size_t n_words,
+             const qa_liaise_point_t *liaise_points, size_t n_liaise_points, qa_span_cb on_span, void *user_data,
+             qa_stats_t *stats);
+
+// Valid until the next call on proc.
+const char *qa_last_error(qa_processor_t *proc);
+
+#ifdef __cplusplus
+}
+#endif
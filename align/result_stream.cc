@@ -0,0 +1,64 @@
+#include "result_stream.h"
+#include <cctype>
+#include <stdexcept>
+
+bool ResultStreamReader::Next(nlohmann::json &result) {
+  if (_done) {
+    return false;
+  }
+  // Skip to the start of the next member.
+  char c;
+  while (_in.get(c)) {
+    if (isspace(c) || (c == ',' && _started)) {
+      continue;
+    }
+    if (c == '[' && !_started) {
+      _started = true;
+      continue;
+    }
+    if (c == ']' && _started) {
+      _done = true;
+      return false;
+    }
+    if (c == 'n' && !_started) {
+      // An empty run serializes as null.
+      _done = true;
+      return false;
+    }
+    if (c == '{' && _started) {
+      break;
+    }
+    throw std::runtime_error(std::string("Unexpected '") + c + "' in result stream");
+  }
+  if (!_in) {
+    throw std::runtime_error("Truncated result stream");
+  }
+
+  // Find the matching close brace, minding strings.
+  std::string text(1, c);
+  int depth = 1;
+  bool in_string = false, escaped = false;
+  while (depth && _in.get(c)) {
+    text.push_back(c);
+    if (in_string) {
+      if (escaped) {
+        escaped = false;
+      } else if (c == '\\') {
+        escaped = true;
+      } else if (c == '"') {
+        in_string = false;
+      }
+    } else if (c == '"') {
+      in_string = true;
+    } else if (c == '{') {
+      depth++;
+    } else if (c == '}') {
+      depth--;
+    }
+  }
+  if (depth) {
+    throw std::runtime_error("Truncated result stream");
+  }
+  result = nlohmann::json::parse(text);
+  return true;
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include "vendor/json.hpp"
+#include <istream>
+#include <stdexcept>
+#include <string>
+
+// Reads the members of a top-level JSON array (i.e. our output) one at a time, so whole result files never need to be
+// in memory at once.
+class ResultStreamReader {
+public:
+  ResultStreamReader(std::istream &in) : _in(in) {}
+  // Returns false once the array is exhausted. Throws if the input isn't an array of objects.
+  bool Next(nlohmann::json &result);
+
+private:
+  std::istream &_in;
+  bool _started = false, _done = false;
+};
+
+// Sort key for result objects. Throws if they've no surah and ayah.
+inline unsigned int result_key(const nlohmann::json &result) {
+  if (!result.count("surah") || !result.at("surah").is_number_unsigned() || !result.count("ayah") ||
+      !result.at("ayah").is_number_unsigned()) {
+    throw std::runtime_error("Result without a surah and ayah: " + result.dump().substr(0, 80));
+  }
+  return result.at("surah").get<unsigned int>() * 1000 + result.at("ayah").get<unsigned int>();
+}
@@ -1,7 +1,6 @@
 #include "segment.h"
 #include "debug.h"
 #include "discriminator.h"
-#include "err.h"
 #include "match.h"
 #include "mmap.h"
 #include "pocketsphinx.h"
@@ -10,16 +9,118 @@
 #include <algorithm>
 #include <cmath>
 #include <fstream>
+#include <iterator>
 #include <limits>
-#include <stack>
-#include <unistd.h>
+#include <memory>
+#include <dirent.h>
+#include <sys/stat.h>
 
-// Enforced gap between output words - matches pocketsphinx because I like consistency and 10msec is negligible.
-const uint32_t INTERWORD_DELAY = 10; // msec
+// Overrides applied to the ps.cfg beams for the fast decoding tier.
+// These prune roughly an order of magnitude harder than the pocketsphinx defaults - fine for the easy ayat, and the
+// caller retries anything that comes out looking dodgy at DecodeTier::Full.
+static const struct {
+  const char *name;
+  double value;
+} FAST_TIER_BEAMS[] = {
+    {"-beam", 1e-20}, {"-wbeam", 1e-15}, {"-pbeam", 1e-20}, {"-lpbeam", 1e-20}, {"-lponlybeam", 1e-15}};
+static const int FAST_TIER_MAXHMMPF = 3000;
 
-SegmentationProcessor::SegmentationProcessor(const std::string &ps_cfg) : _cfg_path(ps_cfg) {
+// I have it on good authority that the audio data starts 78 bytes into the
+// file...
+const size_t WAV_HEADER_SIZE = 78;
+
+// Points audio_data at the job's samples, mapping its file if need be. Keep the returned file until done with them.
+static std::unique_ptr<MMapFile> load_audio(const SegmentationJob &job, const int16_t *&audio_data,
+                                            size_t &audio_samples) {
+  audio_data = job.in_audio;
+  audio_samples = job.in_audio_samples;
+  std::unique_ptr<MMapFile> audio_file;
+  if (!audio_data) {
+    audio_file.reset(new MMapFile(job.in_file));
+    if (audio_file->size() < WAV_HEADER_SIZE) {
+      throw std::runtime_error(job.in_file + " is too short to be a WAV file");
+    }
+    audio_data = (int16_t *)((char *)audio_file->data() + WAV_HEADER_SIZE);
+    audio_samples = (audio_file->size() - WAV_HEADER_SIZE) / sizeof(int16_t);
+  }
+  return audio_file;
+}
+
+unsigned int job_audio_msec(const SegmentationJob &job) {
+  size_t audio_samples = job.in_audio_samples;
+  if (!job.in_audio) {
+    struct stat st;
+    if (stat(job.in_file.c_str(), &st) != 0 || (size_t)st.st_size < WAV_HEADER_SIZE) {
+      return 0;
+    }
+    audio_samples = (st.st_size - WAV_HEADER_SIZE) / sizeof(int16_t);
+  }
+  return WAVF2MSEC(audio_samples);
+}
+
+SegmentationResult even_split(const SegmentationJob &job, const SegmentationParams &params) {
+  SegmentationResult result(job);
+  result.fallback = true;
+  const int16_t *audio_data;
+  size_t audio_samples;
+  auto audio_file = load_audio(job, audio_data, audio_samples);
+  unsigned int audio_len = WAVF2MSEC(audio_samples);
+  if (job.in_words.empty()) {
+    return result;
+  }
+
+  // Invert the silences to get the spoken bits.
+  std::vector<std::pair<uint32_t, uint32_t>> speech;
+  uint32_t speech_start = 0, speech_total = 0;
+  auto silences = discriminate_silence_periods(audio_data, audio_len, params.discriminator);
+  silences.emplace_back(audio_len, audio_len);
+  for (auto sil = silences.begin(); sil != silences.end(); sil++) {
+    if (sil->first > speech_start) {
+      speech.emplace_back(speech_start, sil->first);
+      speech_total += sil->first - speech_start;
+    }
+    speech_start = sil->second;
+  }
+  if (!speech_total) {
+    speech.assign(1, std::make_pair(0u, audio_len));
+    speech_total = audio_len;
+  }
+
+  // Walk through the speech at an even pace, moving words that straddle a silence to whichever side has more of them.
+  float word_len = (float)speech_total / job.in_words.size();
+  float elapsed = 0;
+  auto region = speech.begin();
+  uint32_t region_elapsed = 0; // Speech time before the current region.
+  for (unsigned int i = 0; i < job.in_words.size(); ++i) {
+    float word_start = elapsed, word_end = elapsed + word_len;
+    elapsed = word_end;
+    while (region + 1 != speech.end() && region_elapsed + (region->second - region->first) <= word_start) {
+      region_elapsed += region->second - region->first;
+      region++;
+    }
+    uint32_t region_len = region->second - region->first;
+    uint32_t start = region->first + (uint32_t)(word_start - region_elapsed);
+    uint32_t end = region->first + std::min(region_len, (uint32_t)(word_end - region_elapsed));
+    if (region + 1 != speech.end() && word_end - region_elapsed - region_len > word_len / 2) {
+      // Mostly in the next region - so put it there instead.
+      region_elapsed += region_len;
+      region++;
+      start = region->first;
+      end = region->first + std::min(region->second - region->first, (uint32_t)(word_end - region_elapsed));
+    }
+    result.spans.push_back(
+        {.index_start = i, .index_end = i + 1, .start = start, .end = end, .flags = SpanFlag::Clear});
+  }
+  return result;
+}
+
+std::shared_ptr<const PhoneticDictionary> SegmentationProcessor::LoadDictionary(const std::string &cfg_path) {
   // Load full LM dictionary.
-  auto ps_opts = cmd_ln_parse_file_r(NULL, cont_args_def, _cfg_path.c_str(), true);
+  auto ps_opts = cmd_ln_parse_file_r(NULL, cont_args_def, cfg_path.c_str(), true);
+  if (!ps_opts) {
+    throw std::runtime_error("Couldn't load " + cfg_path);
+  }
+  std::shared_ptr<PhoneticDictionary> dict(new PhoneticDictionary);
   std::string line;
   std::ifstream dict_file(cmd_ln_str_r(ps_opts, "-dict"));
   cmd_ln_free_r(ps_opts);
@@ -30,267 +131,351 @@ SegmentationProcessor::SegmentationProcessor(const std::string &ps_cfg) : _cfg_p
     }
     auto word = line.substr(0, first_space);
     auto phones = line.substr(first_space + 1);
-    _dict[word] = phones;
+    (*dict)[word] = phones;
   }
   dict_file.close();
+  return dict;
+}
+
+std::shared_ptr<const PhoneticDictionary> DictionaryCache::Get(const std::string &cfg_path) {
+  std::lock_guard<std::mutex> lock(_mtx);
+  auto &cached = _dicts[cfg_path];
+  auto dict = cached.lock();
+  if (!dict) {
+    DEBUG("Loading dictionary for " << cfg_path);
+    dict = SegmentationProcessor::LoadDictionary(cfg_path);
+    cached = dict;
+  }
+  return dict;
 }
 
+SegmentationProcessor::SegmentationProcessor(const std::string &ps_cfg, const SegmentationParams &params,
+                                             std::shared_ptr<const PhoneticDictionary> dict)
+    : _cfg_path(ps_cfg), _params(params), _dict(dict ? dict : LoadDictionary(ps_cfg)) {}
+
 SegmentationProcessor::~SegmentationProcessor() {
   if (ps) {
     ps_free(ps);
   }
-  if (fe) {
-    fe_free(fe);
+}
+
+size_t SegmentationProcessor::EstimateMemory(const std::string &cfg_path) {
+  auto ps_opts = cmd_ln_parse_file_r(NULL, cont_args_def, cfg_path.c_str(), true);
+  if (!ps_opts) {
+    throw std::runtime_error("Couldn't load " + cfg_path);
+  }
+  struct stat st;
+  size_t total = 0;
+  if (cmd_ln_str_r(ps_opts, "-lm") && stat(cmd_ln_str_r(ps_opts, "-lm"), &st) == 0) {
+    total += st.st_size;
+  }
+  // The acoustic model is more or less its files, loaded.
+  const char *hmm_dir = cmd_ln_str_r(ps_opts, "-hmm");
+  DIR *dir_handle = hmm_dir ? opendir(hmm_dir) : NULL;
+  if (dir_handle) {
+    struct dirent *entry;
+    while ((entry = readdir(dir_handle))) {
+      if (stat((std::string(hmm_dir) + "/" + entry->d_name).c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+        total += st.st_size;
+      }
+    }
+    closedir(dir_handle);
   }
+  cmd_ln_free_r(ps_opts);
+  return total;
 }
 
-void SegmentationProcessor::ps_setup(const SegmentationJob &job) {
-  // Populate dict.
-  std::unordered_map<std::string, std::string> job_dict;
-  for (auto word = job.in_words.begin(); word != job.in_words.end(); word++) {
-    job_dict[*word] = _dict[*word];
-  }
-  // Write dictionary to tempfile.
-  char dict_fn[L_tmpnam];
-  tmpnam(dict_fn);
-  std::ofstream dict_fh;
-  dict_fh.open(dict_fn);
-  for (auto i = job_dict.begin(); i != job_dict.end(); i++) {
-    dict_fh << i->first << " " << i->second << std::endl;
-  }
-  dict_fh.close();
-
-  // Re/Configure PS
-  err_set_logfp(NULL);
-  err_set_debug_level(0);
-  auto ps_opts = cmd_ln_parse_file_r(NULL, cont_args_def, _cfg_path.c_str(), true);
-  err_set_logfp(NULL);
-  err_set_debug_level(0);
-  cmd_ln_set_str_r(ps_opts, "-dict", dict_fn);
-  ps_default_search_args(ps_opts);
+size_t SegmentationProcessor::EstimateDictionaryMemory(const std::string &cfg_path) {
+  auto ps_opts = cmd_ln_parse_file_r(NULL, cont_args_def, cfg_path.c_str(), true);
+  if (!ps_opts) {
+    throw std::runtime_error("Couldn't load " + cfg_path);
+  }
+  struct stat st;
+  size_t total = 0;
+  // Hashing and std::string overhead roughly triple the file.
+  if (cmd_ln_str_r(ps_opts, "-dict") && stat(cmd_ln_str_r(ps_opts, "-dict"), &st) == 0) {
+    total = st.st_size * 3;
+  }
+  cmd_ln_free_r(ps_opts);
+  return total;
+}
 
+void SegmentationProcessor::ps_setup(const SegmentationJob &job, DecodeTier tier) {
   if (!ps) {
+    // The models are loaded the once - after that, jobs only change the dictionary and search settings.
+    auto ps_opts = cmd_ln_parse_file_r(NULL, cont_args_def, _cfg_path.c_str(), true);
+    if (!ps_opts) {
+      throw std::runtime_error("Couldn't load " + _cfg_path);
+    }
+    ps_default_search_args(ps_opts);
+    // Each job brings its own words, so there's no use loading the full dictionary into the decoder.
+    cmd_ln_set_str_r(ps_opts, "-dict", NULL);
+    for (auto beam = std::begin(FAST_TIER_BEAMS); beam != std::end(FAST_TIER_BEAMS); beam++) {
+      _cfg_beams.push_back(cmd_ln_float64_r(ps_opts, beam->name));
+    }
+    _cfg_maxhmmpf = cmd_ln_int32_r(ps_opts, "-maxhmmpf");
     ps = ps_init(ps_opts);
-  } else {
-    ps_reinit(ps, ps_opts);
+    cmd_ln_free_r(ps_opts);
+    if (!ps) {
+      throw std::runtime_error("Couldn't initialize pocketsphinx from " + _cfg_path);
+    }
   }
 
-  if (fe) {
-    fe_free(fe);
+  // Restrict the decoder to the job's words.
+  std::unordered_map<std::string, std::string> job_dict;
+  for (auto word = job.in_words.begin(); word != job.in_words.end(); word++) {
+    auto phones = _dict->find(*word);
+    job_dict[*word] = phones != _dict->end() ? phones->second : "";
   }
-  fe = fe_init_auto_r(ps_opts);
-  err_set_logfp(NULL);
-  err_set_debug_level(0);
+  std::vector<std::pair<std::string, std::string>> job_words(job_dict.begin(), job_dict.end());
 
-  unlink((const char *)dict_fn);
+  // The searches pick these up when ps_shim_set_words reinitializes them.
+  cmd_ln_t *ps_opts = ps_get_config(ps);
+  for (size_t i = 0; i < _cfg_beams.size(); ++i) {
+    cmd_ln_set_float_r(ps_opts, FAST_TIER_BEAMS[i].name,
+                       tier == DecodeTier::Fast ? FAST_TIER_BEAMS[i].value : _cfg_beams[i]);
+  }
+  cmd_ln_set_int_r(ps_opts, "-maxhmmpf", tier == DecodeTier::Fast ? FAST_TIER_MAXHMMPF : _cfg_maxhmmpf);
+  // The flat-lexicon rescoring pass is most of the remaining runtime, so the fast tier skips it.
+  if (ps_shim_set_words(ps, job_words, tier != DecodeTier::Fast) < 0) {
+    throw std::runtime_error("Couldn't set up the decoder for " + job.in_file);
+  }
 }
 
-SegmentationResult SegmentationProcessor::Run(const SegmentationJob &job) {
-  ps_setup(job);
-  SegmentationResult result(job);
-  std::stack<SegmentedWordSpan> run;
+SegmentationResult SegmentationProcessor::Run(const SegmentationJob &job, DecodeTier tier,
+                                              std::chrono::steady_clock::time_point deadline) {
+  return refine_recognition(*Recognize(job, tier, deadline), _params);
+}
 
-  // I have it on good authority that the audio data starts 78 bytes into the
-  // file...
-  MMapFile audio_file(job.in_file);
-  const int16_t *audio_data = (int16_t *)((char *)audio_file.data() + 78);
-  size_t audio_samples = (audio_file.size() - 78) / sizeof(int16_t);
+std::unique_ptr<Recognition> SegmentationProcessor::Recognize(const SegmentationJob &job, DecodeTier tier,
+                                                              std::chrono::steady_clock::time_point deadline) {
+  ps_setup(job, tier);
+  std::unique_ptr<Recognition> recognition(new Recognition(job));
+  recognition->audio_file = load_audio(job, recognition->audio, recognition->audio_samples);
+  const int16_t *audio_data = recognition->audio;
+  size_t audio_samples = recognition->audio_samples;
   unsigned int audio_len = audio_samples / (WAV_SAMPLE_RATE / 1000); // msec!
 
-  // Make the first SegmentedWordSpan to process.
-  run.push({.index_start = 0,
-            .index_end = (unsigned int)job.in_words.size(), // One past the last element!
-            .start = 0,
-            .end = audio_len});
-
-  // Run until we finish all the available work.
-  while (!run.empty()) {
-    auto span = run.top();
-    run.pop();
-    // Attempt to further segment this span.
-    // Start by running recognition with pocketsphinx.
-    std::vector<RecognizedWord> recog_words;
-    ps_start_stream(ps);
-    ps_start_utt(ps);
-    auto frames_processed = ps_process_raw(ps, audio_data + MSEC2WAVF(span.start), MSEC2WAVF(span.end - span.start),
-                                           false /* search */, true /* full utterance */);
-    if (frames_processed < 0) {
-      throw std::runtime_error("Pocketsphinx Fail");
+  // Run recognition with pocketsphinx.
+  std::vector<RecognizedWord> &recog_words = recognition->words;
+  ps_start_stream(ps);
+  ps_start_utt(ps);
+  auto frames_processed =
+      ps_shim_process_raw(ps, audio_data, MSEC2WAVF(audio_len), true /* full utterance */, deadline);
+  if (frames_processed >= 0) {
+    auto end_utt_start = std::chrono::steady_clock::now();
+    frames_processed = ps_shim_end_utt(ps, deadline);
+    // bestpath runs when we first read the segments, and can't be interrupted - so it's only worth starting if
+    // there's at least as long left as the rest of the end-of-utterance passes took.
+    auto now = std::chrono::steady_clock::now();
+    if (frames_processed >= 0 && now + (now - end_utt_start) > deadline) {
+      DEBUG("Skipping bestpath for " << job.in_file);
+      ps_shim_skip_bestpath(ps);
     }
-    ps_end_utt(ps);
-
-    auto iter = ps_seg_iter(ps);
-    int sil_ct = 0;
-    while (iter) {
-      uint32_t word_start_frames, word_end_frames;
-      ps_seg_frames(iter, (int *)&word_start_frames, (int *)&word_end_frames);
-      uint32_t word_start_msec = MFCCF2MSEC(word_start_frames);
-      uint32_t word_end_msec = MFCCF2MSEC(word_end_frames);
-      auto word_text = ps_seg_word(iter);
-      if (strcmp(word_text, "<s>") != 0 && strcmp(word_text, "</s>") != 0 && strcmp(word_text, "<sil>") != 0) {
-        DEBUG("Recog " << recog_words.size() << " \"" << word_text << "\" " << word_start_msec << "~" << word_end_msec);
-        recog_words.push_back({.start = word_start_msec, .end = word_end_msec, .text = word_text});
-      } else if (strcmp(word_text, "</s>") != 0 && recog_words.size() && sil_ct++) {
-        // With remove_silence turned off, these are worse than useless and often are reported on top of other reported
-        // words?
-        DEBUG("SIL " << word_text << " " << word_start_msec << "~" << word_end_msec);
-      }
-      iter = ps_seg_next(iter);
+  }
+  if (frames_processed < 0) {
+    // Not ps_end_utt, which would run the passes we're out of time for. The next ps_setup resets the searches.
+    ps_shim_abandon_utt(ps);
+    if (frames_processed == PS_SHIM_TIMEOUT) {
+      throw SegmentationTimeout();
     }
+    throw std::runtime_error("Pocketsphinx Fail");
+  }
 
-    // Run matcher against the ayah text and the recognized words.
-    // NB since the SegmentedWordSpan can be only part of an ayah, we slice the
-    // ayah words vector.
-    // And by "slice" I mean "copy while yearning for Go's slicing."
-    std::vector<std::string> words_slice(&job.in_words[span.index_start], &job.in_words[span.index_end]);
-    auto match_results = match_words(recog_words, words_slice, result.stats);
-
-    // Patch up last word's end time since there's an obscure case where it can be 0.
-    if (!match_results.rbegin()->end) {
-      match_results.rbegin()->end = audio_len;
+  auto iter = ps_seg_iter(ps);
+  int sil_ct = 0;
+  while (iter) {
+    uint32_t word_start_frames, word_end_frames;
+    ps_seg_frames(iter, (int *)&word_start_frames, (int *)&word_end_frames);
+    uint32_t word_start_msec = MFCCF2MSEC(word_start_frames);
+    uint32_t word_end_msec = MFCCF2MSEC(word_end_frames);
+    auto word_text = ps_seg_word(iter);
+    if (strcmp(word_text, "<s>") != 0 && strcmp(word_text, "</s>") != 0 && strcmp(word_text, "<sil>") != 0) {
+      DEBUG("Recog " << recog_words.size() << " \"" << word_text << "\" " << word_start_msec << "~" << word_end_msec);
+      recog_words.push_back({.start = word_start_msec, .end = word_end_msec, .text = word_text});
+    } else if (strcmp(word_text, "</s>") != 0 && recog_words.size() && sil_ct++) {
+      // With remove_silence turned off, these are worse than useless and often are reported on top of other reported
+      // words?
+      DEBUG("SIL " << word_text << " " << word_start_msec << "~" << word_end_msec);
     }
+    iter = ps_seg_next(iter);
+  }
 
-    // Drop infeasible spans.
-    // This can happen if the qari missed a part of the ayah and the matcher stuffed a bunch of missing words into
-    // 10msec.
-    match_results.erase(
-        std::remove_if(match_results.begin(), match_results.end(),
-                       [](SegmentedWordSpan &span) {
-                         const uint32_t MIN_WORD_LEN = 100;
-                         if (!(span.flags & SpanFlag::MatchedInput)) {
-                           if (span.end - span.start < (span.index_end - span.index_start) * MIN_WORD_LEN) {
-                             DEBUG("Dropping too-short span " << span.index_start << "-" << span.index_end << " (len "
-                                                              << span.end - span.start << ")");
-                             return true;
-                           }
+  // Features for the MFCC transition discriminator. They live in the decoder's buffer, which the next job reuses.
+  size_t size_inout = audio_samples;
+  auto mfcc = acmod_shim_calculate_mfcc(ps->acmod, audio_data, &size_inout);
+  if (mfcc) {
+    recognition->mfcc_frames = size_inout;
+    recognition->mfcc_stride = fe_get_output_size(ps->acmod->fe);
+    recognition->mfcc.assign(mfcc[0], mfcc[0] + recognition->mfcc_frames * recognition->mfcc_stride);
+  }
+  return recognition;
+}
+
+SegmentationResult refine_recognition(const Recognition &recognition, const SegmentationParams &params) {
+  const SegmentationJob &job = recognition.job;
+  SegmentationResult result(job);
+  const int16_t *audio_data = recognition.audio;
+  unsigned int audio_len = recognition.audio_samples / (WAV_SAMPLE_RATE / 1000); // msec!
+
+  // Run matcher against the ayah text and the recognized words.
+  // It wants mutable inputs, and the recognition may be refined several times over - so copies it is.
+  std::vector<RecognizedWord> recog_words(recognition.words);
+  std::vector<std::string> ref_words(job.in_words);
+  auto match_results = match_words(recog_words, ref_words, result.stats);
+  if (match_results.empty()) {
+    // No reference words, so nothing to refine.
+    return result;
+  }
+
+  // Patch up last word's end time since there's an obscure case where it can be 0.
+  if (!match_results.rbegin()->end) {
+    match_results.rbegin()->end = audio_len;
+  }
+
+  // Drop infeasible spans.
+  // This can happen if the qari missed a part of the ayah and the matcher stuffed a bunch of missing words into
+  // 10msec.
+  match_results.erase(
+      std::remove_if(match_results.begin(), match_results.end(),
+                     [&](SegmentedWordSpan &span) {
+                       if (!(span.flags & SpanFlag::MatchedInput)) {
+                         if (span.end - span.start < (span.index_end - span.index_start) * params.min_word_len) {
+                           DEBUG("Dropping too-short span " << span.index_start << "-" << span.index_end << " (len "
+                                                            << span.end - span.start << ")");
+                           return true;
                          }
-                         return false;
-                       }),
-        match_results.end());
-
-    // Run through discriminator to better resolve inter-word transitions.
-    auto aural_silences = discriminate_silence_periods(audio_data, audio_len);
-    size_t size_inout = audio_samples;
-    auto mfcc = acmod_shim_calculate_mfcc(ps->acmod, audio_data, &size_inout);
-    auto aural_transitions = discriminate_transitions(audio_data, mfcc, audio_len);
-
-    for (auto match_res = match_results.begin(); match_res != match_results.end(); match_res++) {
-      DEBUG("Match " << match_res->index_start << "-" << match_res->index_end << " " << match_res->start << "~"
-                     << match_res->end);
-    }
-    for (auto sil = aural_silences.begin(); sil != aural_silences.end(); sil++) {
-      DEBUG("Silence " << sil->first << "~" << sil->second);
-    }
-    for (auto tn = aural_transitions.begin(); tn != aural_transitions.end(); tn++) {
-      DEBUG("Transition " << *tn);
-    }
+                       }
+                       return false;
+                     }),
+      match_results.end());
+  if (match_results.empty()) {
+    return result;
+  }
 
-    // Move any words that fall in silences.
-    auto silence_iter = aural_silences.begin();
-    for (auto match_res = match_results.begin(); match_res != match_results.end(); match_res++) {
-      while (silence_iter != aural_silences.end() && match_res->start > silence_iter->second) {
-        silence_iter++;
-      }
+  // Run through discriminator to better resolve inter-word transitions.
+  auto aural_silences = discriminate_silence_periods(audio_data, audio_len, params.discriminator);
+  std::vector<const mfcc_t *> mfcc(recognition.mfcc_frames);
+  for (size_t frame = 0; frame < mfcc.size(); ++frame) {
+    mfcc[frame] = recognition.mfcc.data() + frame * recognition.mfcc_stride;
+  }
+  auto aural_transitions =
+      discriminate_transitions(audio_data, mfcc.data(), mfcc.size(), audio_len, params.discriminator);
 
-      if (silence_iter == aural_silences.end()) {
-        continue;
-      }
+  for (auto match_res = match_results.begin(); match_res != match_results.end(); match_res++) {
+    DEBUG("Match " << match_res->index_start << "-" << match_res->index_end << " " << match_res->start << "~"
+                   << match_res->end);
+  }
+  for (auto sil = aural_silences.begin(); sil != aural_silences.end(); sil++) {
+    DEBUG("Silence " << sil->first << "~" << sil->second);
+  }
+  for (auto tn = aural_transitions.begin(); tn != aural_transitions.end(); tn++) {
+    DEBUG("Transition " << *tn);
+  }
 
-      if (match_res->start > silence_iter->first && match_res->start < silence_iter->second) {
-        DEBUG("Shifting span " << match_res - match_results.begin() << " start from " << match_res->start
-                               << " to end of silence at " << silence_iter->second);
-        match_res->start = silence_iter->second;
-      }
+  // Move any words that fall in silences.
+  auto silence_iter = aural_silences.begin();
+  for (auto match_res = match_results.begin(); match_res != match_results.end(); match_res++) {
+    while (silence_iter != aural_silences.end() && match_res->start > silence_iter->second) {
+      silence_iter++;
     }
 
-    // Find pairs of words where the earlier ends with the same letter as the latter starts with.
-    for (auto pt = job.liaise_points.begin(); pt != job.liaise_points.end(); pt++) {
-      auto match_res = match_results.begin();
-      do {
-        if (match_res->index_start <= pt->index && match_res->index_end > pt->index) {
-          break;
-        }
-      } while (++match_res != match_results.end());
-      if (match_res == match_results.end()) {
-        continue;
-      }
+    if (silence_iter == aural_silences.end()) {
+      continue;
+    }
 
-      auto last_match_res = match_results.begin() + (match_res - match_results.begin() - 1);
-      float best_tn = std::numeric_limits<float>::max();
-      const float forward_derate = 1; // (Neutered) factor to prefer moving forward rather than backwards...
-      const uint32_t max_backtrack = 300;
-      for (auto tn = aural_transitions.begin(); tn != aural_transitions.end(); tn++) {
-        float derate = *tn > match_res->start ? forward_derate : 1;
-        if (std::fabs((float)*tn - (float)match_res->start) * derate <
-                std::fabs((float)best_tn - (float)match_res->start) &&
-            *tn < match_res->end) {
-          if ((int)match_res->start - (int)*tn < (int)max_backtrack) {
-            best_tn = *tn;
-          }
-        } else {
-          break;
-        }
+    if (match_res->start > silence_iter->first && match_res->start < silence_iter->second) {
+      DEBUG("Shifting span " << match_res - match_results.begin() << " start from " << match_res->start
+                             << " to end of silence at " << silence_iter->second);
+      match_res->start = silence_iter->second;
+    }
+  }
+
+  // Find pairs of words where the earlier ends with the same letter as the latter starts with.
+  for (auto pt = job.liaise_points.begin(); pt != job.liaise_points.end(); pt++) {
+    auto match_res = match_results.begin();
+    do {
+      if (match_res->index_start <= pt->index && match_res->index_end > pt->index) {
+        break;
       }
-      if (best_tn < std::numeric_limits<float>::max()) {
-        DEBUG("Aur " << best_tn << " span " << pt->index << " running " << match_res->start << "~" << match_res->end);
-        if (match_res != match_results.begin()) {
-          last_match_res->end = best_tn;
-          match_res->start = best_tn + INTERWORD_DELAY;
-          DEBUG("Shifting span " << pt->index << " start = " << best_tn + INTERWORD_DELAY << "msec (old " << old_start
-                                 << " diff " << INTERWORD_DELAY << ")");
-        } else {
-          match_res->start = best_tn;
-          DEBUG("Shifting span " << pt->index << " start = " << best_tn << "msec");
+    } while (++match_res != match_results.end());
+    if (match_res == match_results.end()) {
+      continue;
+    }
+
+    auto last_match_res = match_results.begin() + (match_res - match_results.begin() - 1);
+    float best_tn = std::numeric_limits<float>::max();
+    const float forward_derate = 1; // (Neutered) factor to prefer moving forward rather than backwards...
+    for (auto tn = aural_transitions.begin(); tn != aural_transitions.end(); tn++) {
+      float derate = *tn > match_res->start ? forward_derate : 1;
+      if (std::fabs((float)*tn - (float)match_res->start) * derate <
+              std::fabs((float)best_tn - (float)match_res->start) &&
+          *tn < match_res->end) {
+        if ((int)match_res->start - (int)*tn < (int)params.max_backtrack) {
+          best_tn = *tn;
         }
+      } else {
+        break;
       }
     }
-
-    // Fix word endings.
-    silence_iter = aural_silences.begin();
-    for (auto match_res = match_results.begin(); match_res != match_results.end(); match_res++) {
-      // Iterate through silences s/t silence_iter is always a silence that ends after the current word.
-      while (silence_iter != aural_silences.end() && match_res->end > silence_iter->second) {
-        silence_iter++;
+    if (best_tn < std::numeric_limits<float>::max()) {
+      DEBUG("Aur " << best_tn << " span " << pt->index << " running " << match_res->start << "~" << match_res->end);
+      if (match_res != match_results.begin()) {
+        last_match_res->end = best_tn;
+        match_res->start = best_tn + INTERWORD_DELAY;
+        DEBUG("Shifting span " << pt->index << " start = " << best_tn + INTERWORD_DELAY << "msec (old " << old_start
+                               << " diff " << INTERWORD_DELAY << ")");
+      } else {
+        match_res->start = best_tn;
+        DEBUG("Shifting span " << pt->index << " start = " << best_tn << "msec");
       }
+    }
+  }
 
-      auto next_match_res = match_results.begin() + (match_res - match_results.begin()) + 1;
-      if (next_match_res != match_results.end()) {
-        // If the silence ends after the current word (see above) and starts before the next word,
-        // shift the end of this word forward to the beginning of that silence.
-        if (silence_iter != aural_silences.end() && silence_iter->first < next_match_res->start) {
-          DEBUG("Shifting end of span " << match_res - match_results.begin() << " to start of silence at "
-                                        << silence_iter->first);
-          match_res->end = silence_iter->first;
-        } else {
-          // Otherwise, shift it to immediately before the start of the next word.
-          DEBUG("Shifting end of span " << match_res - match_results.begin()
-                                        << " to immediately before start of next span at "
-                                        << next_match_res->start + INTERWORD_DELAY);
-          match_res->end = next_match_res->start - INTERWORD_DELAY;
-        }
+  // Fix word endings.
+  silence_iter = aural_silences.begin();
+  for (auto match_res = match_results.begin(); match_res != match_results.end(); match_res++) {
+    // Iterate through silences s/t silence_iter is always a silence that ends after the current word.
+    while (silence_iter != aural_silences.end() && match_res->end > silence_iter->second) {
+      silence_iter++;
+    }
 
-        // Sanity check
-        if (match_res->end < match_res->start) {
-          DEBUG("Span " << match_res - match_results.begin() << " ends before it starts!");
-        } else if (match_res->end > next_match_res->start) {
-          DEBUG("Span " << match_res - match_results.begin() << " starts before the next begins!");
-        }
+    auto next_match_res = match_results.begin() + (match_res - match_results.begin()) + 1;
+    if (next_match_res != match_results.end()) {
+      // If the silence ends after the current word (see above) and starts before the next word,
+      // shift the end of this word forward to the beginning of that silence.
+      if (silence_iter != aural_silences.end() && silence_iter->first < next_match_res->start) {
+        DEBUG("Shifting end of span " << match_res - match_results.begin() << " to start of silence at "
+                                      << silence_iter->first);
+        match_res->end = silence_iter->first;
       } else {
-        // No next word - we're at the end of an ayah - so snap the word-end to the presumably-final silence.
-        if (silence_iter != aural_silences.end()) {
-          DEBUG("Shifting end of span " << match_res - match_results.begin() << " to start of final silence at "
-                                        << silence_iter->first);
-          match_res->end = silence_iter->first;
-        }
+        // Otherwise, shift it to immediately before the start of the next word.
+        DEBUG("Shifting end of span " << match_res - match_results.begin()
+                                      << " to immediately before start of next span at "
+                                      << next_match_res->start + INTERWORD_DELAY);
+        match_res->end = next_match_res->start - INTERWORD_DELAY;
+      }
 
-        // Sanity check, again.
-        if (match_res->end < match_res->start) {
-          DEBUG("Span " << match_res - match_results.begin() << " ends before it starts!");
-        }
+      // Sanity check
+      if (match_res->end < match_res->start) {
+        DEBUG("Span " << match_res - match_results.begin() << " ends before it starts!");
+      } else if (match_res->end > next_match_res->start) {
+        DEBUG("Span " << match_res - match_results.begin() << " starts before the next begins!");
+      }
+    } else {
+      // No next word - we're at the end of an ayah - so snap the word-end to the presumably-final silence.
+      if (silence_iter != aural_silences.end()) {
+        DEBUG("Shifting end of span " << match_res - match_results.begin() << " to start of final silence at "
+                                      << silence_iter->first);
+        match_res->end = silence_iter->first;
+      }
+
+      // Sanity check, again.
+      if (match_res->end < match_res->start) {
+        DEBUG("Span " << match_res - match_results.begin() << " ends before it starts!");
       }
     }
-    result.spans.swap(match_results);
   }
-
+  result.spans.swap(match_results);
   return result;
 }
@@ -1,7 +1,14 @@
 #pragma once
+#include "discriminator.h"
+#include "mmap.h"
 #include "pocketsphinx.h"
+#include <chrono>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <set>
+#include <stdexcept>
 #include <string>
 #include <tuple>
 #include <unordered_map>
@@ -9,8 +16,14 @@
 
 static const arg_t cont_args_def[] = {POCKETSPHINX_OPTIONS, CMDLN_EMPTY_OPTION};
 
+// Enforced gap between output words - matches pocketsphinx because I like consistency and 10msec is negligible.
+const uint32_t INTERWORD_DELAY = 10; // msec
+
 enum LiaiseFlags { Backtrack = 1 };
 
+// Fast decodes with aggressively-pruned beams, Full uses whatever ps.cfg specifies.
+enum DecodeTier { Fast = 0, Full = 1 };
+
 struct LiaisePoint {
   uint16_t index;
   LiaiseFlags flags;
@@ -21,6 +34,9 @@ struct SegmentationJob {
   std::string in_file;
   std::vector<std::string> in_words;
   std::vector<LiaisePoint> liaise_points;
+  // 16kHz mono samples to use in place of reading in_file, if set. Not owned by the job.
+  const int16_t *in_audio;
+  size_t in_audio_samples;
 };
 
 struct RecognizedWord {
@@ -47,18 +63,90 @@ struct SegmentationResult {
   const SegmentationJob &job;
   std::vector<SegmentedWordSpan> spans;
   SegmentationStats stats;
+  bool fallback = false; // Spans are from even_split, not recognition.
+};
+
+// Everything that shapes word boundaries after recognition, so they can be tuned without a rebuild - see params.h.
+struct SegmentationParams {
+  DiscriminatorParams discriminator;
+  uint32_t max_backtrack = 300; // How far back (msec) a liaison's start can move to meet an aural transition.
+  uint32_t min_word_len = 100;  // Unmatched spans shorter than this per word (msec) are dropped as infeasible.
+};
+
+// What pocketsphinx made of a job's audio - all refine_recognition needs, so it can be rerun with different params
+// without decoding again.
+struct Recognition {
+  Recognition(const SegmentationJob &job) : job(job){};
+  const SegmentationJob &job;
+  std::unique_ptr<MMapFile> audio_file; // Backs audio, unless the job brought its own.
+  const int16_t *audio = NULL;
+  size_t audio_samples = 0;
+  std::vector<RecognizedWord> words;
+  std::vector<mfcc_t> mfcc; // mfcc_frames rows of mfcc_stride coefficients.
+  size_t mfcc_frames = 0, mfcc_stride = 0;
+};
+
+// Matches the recognized words to the job's and fixes up their boundaries with the discriminators.
+// Doesn't touch the decoder, so any number can run at once over the same recognition.
+SegmentationResult refine_recognition(const Recognition &recognition, const SegmentationParams &params);
+
+// Thrown by SegmentationProcessor::Run when decoding runs past its deadline.
+class SegmentationTimeout : public std::runtime_error {
+public:
+  SegmentationTimeout() : std::runtime_error("Decoding took too long") {}
+};
+
+// Length of the job's audio, msec.
+unsigned int job_audio_msec(const SegmentationJob &job);
+
+// Last resort when decoding isn't an option: share the words out evenly over the non-silent parts of the audio, as
+// params' silence settings find them.
+SegmentationResult even_split(const SegmentationJob &job, const SegmentationParams &params);
+
+// Word -> phones, for every word the LM knows.
+typedef std::unordered_map<std::string, std::string> PhoneticDictionary;
+
+// Hands out one dictionary per cfg, shared by every processor given it, and dropped once none of them are using it.
+// Each processor only reads it to build its small per-job dictionaries, so there's no call for more than one copy.
+class DictionaryCache {
+public:
+  std::shared_ptr<const PhoneticDictionary> Get(const std::string &cfg_path);
+
+private:
+  std::map<std::string, std::weak_ptr<const PhoneticDictionary>> _dicts;
+  std::mutex _mtx;
 };
 
+// Owns a decoder, whose models are loaded on first use and kept - so keep the processor around for the next job.
 class SegmentationProcessor {
 public:
-  SegmentationProcessor(const std::string &cfg_path);
+  // The dictionary is read-only once loaded, so processors for the same cfg can share one - otherwise each loads its
+  // own.
+  SegmentationProcessor(const std::string &cfg_path, const SegmentationParams &params = {},
+                        std::shared_ptr<const PhoneticDictionary> dict = nullptr);
   ~SegmentationProcessor();
-  SegmentationResult Run(const SegmentationJob &job);
+  // Recognize then refine_recognition with this processor's params.
+  SegmentationResult Run(const SegmentationJob &job, DecodeTier tier = DecodeTier::Full,
+                         std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max());
+  std::unique_ptr<Recognition>
+  Recognize(const SegmentationJob &job, DecodeTier tier = DecodeTier::Full,
+            std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max());
+  const SegmentationParams &Params() const { return _params; }
+  static std::shared_ptr<const PhoneticDictionary> LoadDictionary(const std::string &cfg_path);
+  // Rough resident size of a processor for this config once it's decoded something - i.e. the acoustic model and LM.
+  // Its per-job dictionaries are small enough to ignore.
+  static size_t EstimateMemory(const std::string &cfg_path);
+  // Rough size of LoadDictionary's result, which is shared - see DictionaryCache.
+  static size_t EstimateDictionaryMemory(const std::string &cfg_path);
 
 private:
-  void ps_setup(const SegmentationJob &job);
+  friend class StreamingSegmenter;
+  void ps_setup(const SegmentationJob &job, DecodeTier tier);
   std::string _cfg_path;
-  std::unordered_map<std::string, std::string> _dict;
+  SegmentationParams _params;
+  std::shared_ptr<const PhoneticDictionary> _dict;
+  // ps.cfg's values for what the fast tier overrides, to put back for the full one.
+  std::vector<double> _cfg_beams;
+  int _cfg_maxhmmpf = 0;
   ps_decoder_t *ps = NULL;
-  fe_t *fe = NULL;
 };
@@ -0,0 +1,176 @@
+#include "server.h"
+#include "audio_decode.h"
+#include "debug.h"
+#include "metrics.h"
+#include "vendor/json.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+struct ServerJob {
+  nlohmann::json id;
+  SegmentationJob job;
+  std::vector<int16_t> pcm; // Backs job.in_audio when the request sent its samples inline, or pointed at an .mp3.
+};
+
+struct ServerQueue {
+  std::mutex mtx;
+  std::condition_variable not_empty, not_full;
+  std::deque<std::unique_ptr<ServerJob>> jobs;
+  size_t depth;
+  bool closed = false;
+};
+
+static std::mutex output_mtx;
+
+static void write_line(const nlohmann::json &line) {
+  std::lock_guard<std::mutex> output_lock(output_mtx);
+  std::cout << line << std::endl;
+}
+
+static void write_error(const nlohmann::json &id, const std::string &message) {
+  nlohmann::json error_json;
+  error_json["id"] = id;
+  error_json["error"] = message;
+  write_line(error_json);
+}
+
+static bool decode_base64(const std::string &in, std::vector<int16_t> &out) {
+  static const std::string alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::vector<uint8_t> bytes;
+  bytes.reserve(in.size() * 3 / 4);
+  uint32_t accum = 0;
+  int bits = 0;
+  for (auto c = in.begin(); c != in.end() && *c != '='; c++) {
+    auto value = alphabet.find(*c);
+    if (value == std::string::npos) {
+      return false;
+    }
+    accum = (accum << 6) | value;
+    bits += 6;
+    if (bits >= 8) {
+      bits -= 8;
+      bytes.push_back((accum >> bits) & 0xFF);
+    }
+  }
+  // Samples are little-endian, as is anything we'd plausibly be running on.
+  out.resize(bytes.size() / sizeof(int16_t));
+  memcpy(out.data(), bytes.data(), out.size() * sizeof(int16_t));
+  return true;
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point since) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count();
+}
+
+static void server_executor(const std::string &ps_cfg, const TierConfig &tiers, const SegmentationParams &params,
+                            std::shared_ptr<const PhoneticDictionary> dict, ServerQueue &queue, Metrics &metrics) {
+  auto load_start = std::chrono::steady_clock::now();
+  SegmentationProcessor seg_proc(ps_cfg, params, dict);
+  metrics.AddPhaseTime(Phase::Load, seconds_since(load_start));
+  TierStats tier_stats;
+  while (true) {
+    std::unique_lock<std::mutex> queue_lock(queue.mtx);
+    queue.not_empty.wait(queue_lock, [&] { return queue.closed || !queue.jobs.empty(); });
+    if (queue.jobs.empty()) {
+      return;
+    }
+    auto job = std::move(queue.jobs.front());
+    queue.jobs.pop_front();
+    queue_lock.unlock();
+    queue.not_full.notify_one();
+
+    DEBUG("Proc " << job->job.surah << ":" << job->job.ayah);
+    metrics.JobStarted();
+    try {
+      if (!job->job.in_audio && is_compressed_audio(job->job.in_file)) {
+        auto decode_start = std::chrono::steady_clock::now();
+        job->pcm = decode_compressed_audio(job->job.in_file);
+        job->job.in_audio = job->pcm.data();
+        job->job.in_audio_samples = job->pcm.size();
+        metrics.AddPhaseTime(Phase::Decode, seconds_since(decode_start));
+      }
+      auto align_start = std::chrono::steady_clock::now();
+      auto result_json = result_to_json(process_job(seg_proc, job->job, tiers, tier_stats));
+      metrics.AddPhaseTime(Phase::Align, seconds_since(align_start));
+      result_json["id"] = job->id;
+      write_line(result_json);
+      metrics.JobFinished(job_audio_msec(job->job), false);
+    } catch (const std::exception &e) {
+      write_error(job->id, e.what());
+      metrics.JobFinished(0, true);
+    }
+  }
+}
+
+int run_server(const Corpus &corpus, const std::string &ps_cfg, const TierConfig &tiers,
+               const SegmentationParams &params, unsigned int worker_ct, size_t queue_depth,
+               const std::string &metrics_file) {
+  ServerQueue queue;
+  queue.depth = queue_depth ? queue_depth : 1;
+  Metrics metrics;
+  std::unique_ptr<MetricsFileWriter> metrics_writer;
+  if (!metrics_file.empty()) {
+    metrics_writer.reset(new MetricsFileWriter(metrics, metrics_file));
+  }
+  auto dict = SegmentationProcessor::LoadDictionary(ps_cfg);
+  std::vector<std::thread> worker_threads;
+  for (unsigned int i = 0; i < worker_ct; ++i) {
+    worker_threads.emplace_back([&] { server_executor(ps_cfg, tiers, params, dict, queue, metrics); });
+  }
+
+  std::string line;
+  while (std::getline(std::cin, line)) {
+    if (line.empty()) {
+      continue;
+    }
+    std::unique_ptr<ServerJob> job(new ServerJob);
+    try {
+      auto request = nlohmann::json::parse(line);
+      job->id = request.count("id") ? request["id"] : nlohmann::json();
+      unsigned short surah = request["surah"].get<unsigned short>();
+      unsigned short ayah = request["ayah"].get<unsigned short>();
+      if (!corpus.HasAyah(surah, ayah)) {
+        write_error(job->id, "No such ayah");
+        continue;
+      }
+      if (request.count("pcm")) {
+        job->job = corpus.MakeJob(surah, ayah, "");
+        if (!decode_base64(request["pcm"].get<std::string>(), job->pcm)) {
+          write_error(job->id, "Malformed pcm");
+          continue;
+        }
+        job->job.in_audio = job->pcm.data();
+        job->job.in_audio_samples = job->pcm.size();
+      } else {
+        job->job = corpus.MakeJob(surah, ayah, request["audio"].get<std::string>());
+      }
+    } catch (const std::exception &e) {
+      write_error(job->id, e.what());
+      continue;
+    }
+
+    metrics.SetJobsTotal(metrics.JobsTotal() + 1);
+    std::unique_lock<std::mutex> queue_lock(queue.mtx);
+    queue.not_full.wait(queue_lock, [&] { return queue.jobs.size() < queue.depth; });
+    queue.jobs.push_back(std::move(job));
+    queue_lock.unlock();
+    queue.not_empty.notify_one();
+  }
+
+  // Input's done - let the workers drain the queue then leave.
+  {
+    std::lock_guard<std::mutex> queue_lock(queue.mtx);
+    queue.closed = true;
+  }
+  queue.not_empty.notify_all();
+  for (auto thread = worker_threads.begin(); thread != worker_threads.end(); thread++) {
+    thread->join();
+  }
+  return 0;
+}
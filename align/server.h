@@ -0,0 +1,12 @@
+#pragma once
+#include "corpus.h"
+#include "pipeline.h"
+#include <string>
+
+// Keeps worker_ct warm SegmentationProcessors resident and feeds them jobs read as JSON lines from stdin.
+// Each result is written to stdout as a single line as soon as it's ready - so not necessarily in input order, hence
+// the caller-supplied "id" being echoed back. Reading stops while queue_depth jobs are waiting, so a fast producer gets
+// blocked instead of ballooning our memory. If metrics_file isn't empty, it's kept updated as per MetricsFileWriter.
+int run_server(const Corpus &corpus, const std::string &ps_cfg, const TierConfig &tiers,
+               const SegmentationParams &params, unsigned int worker_ct, size_t queue_depth,
+               const std::string &metrics_file);
@@ -0,0 +1,48 @@
+#include "shard.h"
+#include <algorithm>
+#include <sys/stat.h>
+
+static unsigned int hash_shard(const SegmentationJob &job, unsigned int shard_ct) {
+  // Surah/ayah keys are far too regular to just take the modulus, so they're mixed with murmur3's finalizer first.
+  uint32_t key = job.surah * 1000 + job.ayah;
+  key ^= key >> 16;
+  key *= 0x85ebca6b;
+  key ^= key >> 13;
+  key *= 0xc2b2ae35;
+  key ^= key >> 16;
+  // Then scaled into range, rather than taking the modulus, so it's the high bits that pick the shard.
+  return ((uint64_t)key * shard_ct) >> 32;
+}
+
+std::vector<unsigned int> assign_shards(const std::vector<const SegmentationJob *> &jobs, unsigned int shard_ct,
+                                        ShardStrategy strategy) {
+  std::vector<unsigned int> assignment(jobs.size());
+  if (strategy == ShardStrategy::ShardByHash) {
+    for (size_t i = 0; i < jobs.size(); ++i) {
+      assignment[i] = hash_shard(*jobs[i], shard_ct);
+    }
+  } else {
+    // Longest-first onto whichever shard has the least audio so far.
+    std::vector<std::pair<off_t, size_t>> sizes;
+    for (size_t i = 0; i < jobs.size(); ++i) {
+      struct stat st;
+      sizes.emplace_back(stat(jobs[i]->in_file.c_str(), &st) == 0 ? st.st_size : 0, i);
+    }
+    std::sort(sizes.begin(), sizes.end(), [&](const std::pair<off_t, size_t> &a, const std::pair<off_t, size_t> &b) {
+      if (a.first != b.first) {
+        return a.first > b.first;
+      }
+      // Tie-break on the ayah rather than argv order, so shuffled file lists still agree.
+      return std::make_pair(jobs[a.second]->surah, jobs[a.second]->ayah) <
+             std::make_pair(jobs[b.second]->surah, jobs[b.second]->ayah);
+    });
+    std::vector<off_t> shard_load(shard_ct);
+    for (auto size = sizes.begin(); size != sizes.end(); size++) {
+      auto lightest = std::min_element(shard_load.begin(), shard_load.end()) - shard_load.begin();
+      assignment[size->second] = lightest;
+      shard_load[lightest] += size->first;
+    }
+  }
+
+  return assignment;
+}
@@ -0,0 +1,11 @@
+#pragma once
+#include "segment.h"
+#include <vector>
+
+// Hash spreads ayat evenly by count; Size balances total audio duration (by file size) instead.
+// Both are deterministic, so every machine agrees on the split as long as they're given the same file list.
+enum ShardStrategy { ShardByHash, ShardBySize };
+
+// Returns which of shard_ct shards each job belongs to.
+std::vector<unsigned int> assign_shards(const std::vector<const SegmentationJob *> &jobs, unsigned int shard_ct,
+                                        ShardStrategy strategy);
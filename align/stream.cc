@@ -0,0 +1,230 @@
+#include "stream.h"
+#include "debug.h"
+#include "pocketsphinx.h"
+#include "ps_shim.h"
+#include "rates.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+// How many reference words past the expected one we'll look for a recognized word - beyond that we call it an
+// insertion rather than assume the qari skipped ahead.
+const unsigned int MATCH_LOOKAHEAD = 3;
+// A word has to keep its position (within this much) across consecutive hypotheses before it's reported.
+const unsigned int STABLE_JITTER = 30; // msec
+StreamingSegmenter::StreamingSegmenter(SegmentationProcessor &seg_proc, const SegmentationJob &job,
+                                       unsigned int hold_back_msec)
+    : _seg_proc(seg_proc), _job(job), _hold_back_msec(hold_back_msec),
+      _detector_pos(seg_proc.Params().discriminator.power_window),
+      _transition_pos(seg_proc.Params().discriminator.power_window + MSEC2WAVF(POWER_TRANSITION_SKIP_LEAD)),
+      _silence_detector(seg_proc.Params().discriminator), _transition_detector(seg_proc.Params().discriminator) {
+  // Mirror collapse_muqataat's renumbering, since we can't fix the events up after they've gone out.
+  unsigned int merged = 0;
+  bool in_muqataat = false;
+  for (auto word = job.in_words.begin(); word != job.in_words.end(); word++) {
+    bool collapsed = false;
+    if ((in_muqataat && word->size() == 0) || (*word)[0] == '_') {
+      collapsed = in_muqataat;
+      in_muqataat = true;
+    }
+    _out_index.push_back(word - job.in_words.begin() - merged);
+    _collapsed.push_back(collapsed);
+    if (collapsed) {
+      merged++;
+    }
+  }
+
+  _seg_proc.ps_setup(job, DecodeTier::Full);
+  ps_start_stream(_seg_proc.ps);
+  ps_start_utt(_seg_proc.ps);
+}
+
+StreamingSegmenter::~StreamingSegmenter() {
+  if (!_finished) {
+    ps_shim_abandon_utt(_seg_proc.ps);
+  }
+}
+
+std::vector<WordEvent> StreamingSegmenter::Feed(const int16_t *samples, size_t n_samples) {
+  _audio.insert(_audio.end(), samples, samples + n_samples);
+  _audio_end += n_samples;
+  if (ps_process_raw(_seg_proc.ps, samples, n_samples, false /* search */, false /* full utterance */) < 0) {
+    throw std::runtime_error("Pocketsphinx Fail");
+  }
+  run_detectors();
+
+  // Only trust words that have settled down - the decoder's best path up to the last few frames is still in flux.
+  unsigned int now_msec = WAVF2MSEC(_audio_end);
+  unsigned int horizon_msec = now_msec > _hold_back_msec ? now_msec - _hold_back_msec : 0;
+  auto words = hypothesis();
+  std::vector<StreamWord> stable_words;
+  for (auto word = words.begin(); word != words.end() && word->start < horizon_msec; word++) {
+    bool stable = false;
+    for (auto last_word = _last_hypothesis.begin(); last_word != _last_hypothesis.end(); last_word++) {
+      if (last_word->text == word->text && std::abs((int)last_word->start - (int)word->start) <= (int)STABLE_JITTER) {
+        stable = true;
+        break;
+      }
+    }
+    if (!stable) {
+      break;
+    }
+    stable_words.push_back(*word);
+  }
+  _last_hypothesis.swap(words);
+
+  std::vector<WordEvent> events;
+  commit(stable_words, events);
+  // Don't make a word that's followed by a pause wait for the next one to start before it's closed.
+  if (_word_open && _silence_detector.InSilence() &&
+      _silence_detector.SilenceStart() >= _open_start + _seg_proc.Params().min_word_len &&
+      now_msec >= _silence_detector.SilenceStart() + _hold_back_msec) {
+    events.push_back({WordEvent::End, _open_index, _silence_detector.SilenceStart()});
+    _word_open = false;
+  }
+  return events;
+}
+
+std::vector<WordEvent> StreamingSegmenter::Finish() {
+  std::vector<WordEvent> events;
+  ps_end_utt(_seg_proc.ps);
+  _finished = true;
+  run_detectors();
+  unsigned int now_msec = WAVF2MSEC(_audio_end);
+  commit(hypothesis(), events);
+  if (_word_open) {
+    // Snap the last word's end to the presumably-final silence, as Run does.
+    unsigned int end = _open_recognized_end ? _open_recognized_end : now_msec;
+    for (auto sil = _silences.begin(); sil != _silences.end(); sil++) {
+      if (sil->first > _open_start && sil->second >= end) {
+        end = sil->first;
+        break;
+      }
+    }
+    if (_silence_detector.InSilence() && _silence_detector.SilenceStart() > _open_start &&
+        _silence_detector.SilenceStart() < end) {
+      end = _silence_detector.SilenceStart();
+    }
+    events.push_back({WordEvent::End, _open_index, end});
+    _word_open = false;
+  }
+  return events;
+}
+
+void StreamingSegmenter::run_detectors() {
+  const size_t window = _seg_proc.Params().discriminator.power_window;
+  std::pair<uint32_t, uint32_t> silence;
+  const size_t audio_start = _audio_end - _audio.size();
+  for (; _detector_pos <= _audio_end; _detector_pos += window) {
+    if (_silence_detector.Push(_audio.data() + (_detector_pos - audio_start), WAVF2MSEC(_detector_pos), silence)) {
+      DEBUG("Silence " << silence.first << "~" << silence.second);
+      _silences.push_back(silence);
+    }
+  }
+  for (; _transition_pos <= _audio_end; _transition_pos += window) {
+    if (_transition_detector.Push(_audio.data() + (_transition_pos - audio_start))) {
+      DEBUG("Transition " << WAVF2MSEC(_transition_pos - window));
+      _transitions.push_back(WAVF2MSEC(_transition_pos - window));
+    }
+  }
+  // The next windows either detector looks at are all we need to keep.
+  size_t keep_from = std::min(_detector_pos, _transition_pos) - window;
+  _audio.erase(_audio.begin(), _audio.begin() + (keep_from - audio_start));
+}
+
+std::vector<StreamingSegmenter::StreamWord> StreamingSegmenter::hypothesis() {
+  std::vector<StreamWord> words;
+  auto iter = ps_seg_iter(_seg_proc.ps);
+  while (iter) {
+    int start_frame, end_frame;
+    ps_seg_frames(iter, &start_frame, &end_frame);
+    auto word_text = ps_seg_word(iter);
+    if (strcmp(word_text, "<s>") != 0 && strcmp(word_text, "</s>") != 0 && strcmp(word_text, "<sil>") != 0) {
+      words.push_back({word_text, (unsigned int)MFCCF2MSEC(start_frame), (unsigned int)MFCCF2MSEC(end_frame)});
+    }
+    iter = ps_seg_next(iter);
+  }
+  return words;
+}
+
+void StreamingSegmenter::commit(const std::vector<StreamWord> &words, std::vector<WordEvent> &events) {
+  for (auto word = words.begin(); word != words.end(); word++) {
+    if (word->start < _committed_until) {
+      continue;
+    }
+    _committed_until = word->end;
+
+    // Find the reference word this is, if it's one at all.
+    unsigned int ref_index = _next_ref;
+    while (ref_index < _job.in_words.size() && ref_index < _next_ref + MATCH_LOOKAHEAD &&
+           _job.in_words[ref_index] != word->text) {
+      ref_index++;
+    }
+    if (ref_index >= _job.in_words.size() || _job.in_words[ref_index] != word->text) {
+      DEBUG("Stream insertion \"" << word->text << "\" " << word->start << "~" << word->end);
+      continue;
+    }
+    _next_ref = ref_index + 1;
+
+    if (_collapsed[ref_index]) {
+      // Another letter of a muqata'at - just stretch the open word over it.
+      _open_recognized_end = word->end;
+      continue;
+    }
+
+    unsigned int start = snap_start(ref_index, *word);
+    if (_word_open) {
+      end_word(start, events);
+    }
+    events.push_back({WordEvent::Start, _out_index[ref_index], start});
+    _word_open = true;
+    _open_index = _out_index[ref_index];
+    _open_start = start;
+    _open_recognized_end = word->end;
+  }
+}
+
+unsigned int StreamingSegmenter::snap_start(unsigned int ref_index, const StreamWord &word) {
+  unsigned int start = word.start;
+  // Move any words that fall in silences.
+  for (auto sil = _silences.begin(); sil != _silences.end(); sil++) {
+    if (start > sil->first && start < sil->second) {
+      start = sil->second;
+      break;
+    }
+  }
+  // And resolve liaised words to the nearest transition, within reason.
+  for (auto pt = _job.liaise_points.begin(); pt != _job.liaise_points.end(); pt++) {
+    if (pt->index != ref_index) {
+      continue;
+    }
+    float best_tn = -1;
+    for (auto tn = _transitions.begin(); tn != _transitions.end(); tn++) {
+      if (*tn >= word.end || (int)start - (int)*tn >= (int)_seg_proc.Params().max_backtrack) {
+        continue;
+      }
+      if (best_tn < 0 || std::fabs((float)*tn - (float)start) < std::fabs(best_tn - (float)start)) {
+        best_tn = *tn;
+      }
+    }
+    if (best_tn >= 0) {
+      DEBUG("Stream aur " << best_tn << " span " << ref_index << " running " << start << "~" << word.end);
+      start = best_tn;
+    }
+  }
+  return start;
+}
+
+void StreamingSegmenter::end_word(unsigned int next_start, std::vector<WordEvent> &events) {
+  // End at the start of any silence before the next word, otherwise immediately before it.
+  unsigned int end = next_start > _open_start + INTERWORD_DELAY ? next_start - INTERWORD_DELAY : _open_start;
+  for (auto sil = _silences.begin(); sil != _silences.end(); sil++) {
+    if (sil->first > _open_start && sil->first < next_start) {
+      end = sil->first;
+      break;
+    }
+  }
+  events.push_back({WordEvent::End, _open_index, end});
+  _word_open = false;
+}
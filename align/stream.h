@@ -0,0 +1,64 @@
+#pragma once
+#include "discriminator.h"
+#include "segment.h"
+#include <string>
+#include <vector>
+
+// Word boundaries as they become known during live recitation.
+// Indexes are into the (muqata'at-collapsed) word list, same as the batch output.
+struct WordEvent {
+  enum Kind { Start, End } kind;
+  unsigned int index;
+  unsigned int msec; // Since the start of the stream.
+};
+
+// Aligns an ayah as its audio arrives, rather than once it's all in memory.
+// Only the power-based discriminators run online - there's no MFCC transition detection - so boundaries are a little
+// rougher than SegmentationProcessor::Run's.
+class StreamingSegmenter {
+public:
+  // A word's Start is reported once two consecutive Feeds' hypotheses agree on it and it's at least hold_back_msec
+  // behind the audio - so with audio fed n msec at a time, that's up to 2n msec after the decoder first hypothesizes
+  // it (which is itself usually some way into the word), and never less than hold_back_msec after it starts. Its End
+  // comes with the next word's Start, or hold_back_msec into a pause after it, whichever's first.
+  StreamingSegmenter(SegmentationProcessor &seg_proc, const SegmentationJob &job, unsigned int hold_back_msec = 100);
+  ~StreamingSegmenter();
+  std::vector<WordEvent> Feed(const int16_t *samples, size_t n_samples);
+  // Call once the audio is over - reports all remaining words.
+  std::vector<WordEvent> Finish();
+
+private:
+  struct StreamWord {
+    std::string text;
+    unsigned int start, end;
+  };
+  void run_detectors();
+  std::vector<StreamWord> hypothesis();
+  void commit(const std::vector<StreamWord> &words, std::vector<WordEvent> &events);
+  unsigned int snap_start(unsigned int ref_index, const StreamWord &word);
+  void end_word(unsigned int end, std::vector<WordEvent> &events);
+
+  SegmentationProcessor &_seg_proc;
+  const SegmentationJob &_job;
+  unsigned int _hold_back_msec;
+  bool _finished = false;
+
+  std::vector<int16_t> _audio; // The tail of the stream the detectors haven't got to yet.
+  size_t _audio_end = 0;       // Samples fed so far. Positions below are counted from the start of the stream.
+  size_t _detector_pos;
+  size_t _transition_pos;
+  SilenceDetector _silence_detector;
+  PowerTransitionDetector _transition_detector;
+  std::vector<std::pair<uint32_t, uint32_t>> _silences;
+  std::vector<uint32_t> _transitions;
+
+  std::vector<StreamWord> _last_hypothesis;
+  unsigned int _next_ref = 0;         // Next reference word we're expecting.
+  unsigned int _committed_until = 0;  // Recognized words starting before this have been dealt with.
+  bool _word_open = false;            // Whether we've reported a Start without a matching End.
+  unsigned int _open_index = 0;
+  unsigned int _open_start = 0;
+  unsigned int _open_recognized_end = 0;
+  std::vector<unsigned int> _out_index; // Reference word index -> output word index.
+  std::vector<bool> _collapsed;         // Reference words folded into a preceding muqata'at word.
+};
@@ -0,0 +1,96 @@
+#pragma once
+// Compact binary version of the JSON output, for playback servers that want to mmap a qari's timings and go.
+// Header-only so it can be dropped into other projects without the rest of the aligner.
+//
+// Layout (little-endian, no padding):
+//   TimingHeader
+//   TimingAyah[n_ayah]  - sorted by surah then ayah.
+//   TimingSpan[n_spans] - each ayah's spans are contiguous, in word order. Their starts never go backwards and none
+//                         ends before it starts - the writer clamps any that the aligner got wrong - so they're in
+//                         time order too, which SpanAt relies on.
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+static const char TIMING_MAGIC[4] = {'Q', 'A', 'T', 'F'};
+static const uint32_t TIMING_VERSION = 1;
+
+struct TimingHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t n_ayah;
+  uint32_t n_spans;
+};
+
+struct TimingAyah {
+  uint16_t surah, ayah;
+  uint32_t first_span; // Index into the span table.
+  uint32_t n_spans;
+};
+
+// Same meaning as the JSON segments - see README.
+struct TimingSpan {
+  uint16_t index_start, index_end;
+  uint32_t start, end; // Msec.
+};
+
+static_assert(sizeof(TimingHeader) == 16 && sizeof(TimingAyah) == 12 && sizeof(TimingSpan) == 12,
+              "Timing file structs must not be padded");
+
+class TimingReader {
+public:
+  // data must stay valid (mapped) for the life of the reader. Check Valid() before use.
+  TimingReader(const void *data, size_t size) {
+    auto header = (const TimingHeader *)data;
+    if (size < sizeof(TimingHeader) || memcmp(header->magic, TIMING_MAGIC, sizeof(TIMING_MAGIC)) != 0 ||
+        header->version != TIMING_VERSION ||
+        size < sizeof(TimingHeader) + header->n_ayah * sizeof(TimingAyah) + header->n_spans * sizeof(TimingSpan)) {
+      return;
+    }
+    _ayat = (const TimingAyah *)(header + 1);
+    _ayat_end = _ayat + header->n_ayah;
+    _spans = (const TimingSpan *)_ayat_end;
+  }
+
+  bool Valid() const { return _ayat != NULL; }
+
+  // All spans for an ayah, as [first, last). Empty if the ayah isn't in the file.
+  std::pair<const TimingSpan *, const TimingSpan *> Spans(uint16_t surah, uint16_t ayah) const {
+    auto entry = std::lower_bound(_ayat, _ayat_end, std::make_pair(surah, ayah),
+                                  [](const TimingAyah &a, const std::pair<uint16_t, uint16_t> &key) {
+                                    return a.surah < key.first || (a.surah == key.first && a.ayah < key.second);
+                                  });
+    if (entry == _ayat_end || entry->surah != surah || entry->ayah != ayah) {
+      return std::make_pair((const TimingSpan *)NULL, (const TimingSpan *)NULL);
+    }
+    return std::make_pair(_spans + entry->first_span, _spans + entry->first_span + entry->n_spans);
+  }
+
+  // The span being recited at msec, or NULL if that's between words (or outside the ayah). Where spans overlap, the
+  // later one.
+  const TimingSpan *SpanAt(uint16_t surah, uint16_t ayah, uint32_t msec) const {
+    auto spans = Spans(surah, ayah);
+    auto after = std::upper_bound(spans.first, spans.second, msec,
+                                  [](uint32_t t, const TimingSpan &span) { return t < span.start; });
+    if (after == spans.first || (after - 1)->end < msec) {
+      return NULL;
+    }
+    return after - 1;
+  }
+
+  // The span containing a word, or NULL if that word wasn't segmented. Its start is when the word starts.
+  const TimingSpan *SpanForWord(uint16_t surah, uint16_t ayah, uint16_t word) const {
+    auto spans = Spans(surah, ayah);
+    auto after = std::upper_bound(spans.first, spans.second, word,
+                                  [](uint16_t w, const TimingSpan &span) { return w < span.index_start; });
+    if (after == spans.first || (after - 1)->index_end <= word) {
+      return NULL;
+    }
+    return after - 1;
+  }
+
+private:
+  const TimingAyah *_ayat = NULL, *_ayat_end = NULL;
+  const TimingSpan *_spans = NULL;
+};
@@ -0,0 +1,36 @@
+#include "timing_writer.h"
+#include "timing_file.h"
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+void write_timing_file(const std::vector<const SegmentationResult *> &results, const std::string &path) {
+  std::vector<TimingAyah> ayat;
+  std::vector<TimingSpan> spans;
+  for (auto result = results.begin(); result != results.end(); result++) {
+    ayat.push_back({(*result)->job.surah, (*result)->job.ayah, (uint32_t)spans.size(), 0});
+    uint32_t last_start = 0;
+    for (auto span = (*result)->spans.begin(); span != (*result)->spans.end(); span++) {
+      // Refining can nudge a boundary past its neighbour's. Lookups want time order, so hold such spans back to where
+      // the previous one starts.
+      uint32_t start = std::max(span->start, last_start);
+      spans.push_back({(uint16_t)span->index_start, (uint16_t)span->index_end, start, std::max(span->end, start)});
+      last_start = start;
+      ayat.back().n_spans++;
+    }
+  }
+
+  TimingHeader header;
+  memcpy(header.magic, TIMING_MAGIC, sizeof(TIMING_MAGIC));
+  header.version = TIMING_VERSION;
+  header.n_ayah = ayat.size();
+  header.n_spans = spans.size();
+
+  std::ofstream out(path, std::ios::binary);
+  out.write((const char *)&header, sizeof(header));
+  out.write((const char *)ayat.data(), ayat.size() * sizeof(TimingAyah));
+  out.write((const char *)spans.data(), spans.size() * sizeof(TimingSpan));
+  if (!out.good()) {
+    throw std::runtime_error("Couldn't write " + path);
+  }
+}
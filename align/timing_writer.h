@@ -0,0 +1,8 @@
+#pragma once
+#include "segment.h"
+#include <string>
+#include <vector>
+
+// Writes results in the timing_file.h format. Results must already be in surah/ayah order; spans are clamped into time
+// order on the way out.
+void write_timing_file(const std::vector<const SegmentationResult *> &results, const std::string &path);